@@ -12,6 +12,11 @@
 #include "mauku-view.h"
 #include "mauku-contacts.h"
 #include "mauku-write.h"
+#include "mauku-atlas.h"
+
+#define OVERVIEW_MAX_ITEMS 400
+#define OVERVIEW_MAX_AGE (7 * 24 * 60 * 60)
+#define OVERVIEW_MAX_BYTES (8 * 1024 * 1024)
 
 static void image_stored(MicrofeedSubscriber* subscriber, const char* publisher, const char* url, const char* path, void* user_data);
 
@@ -37,7 +42,7 @@ static void image_stored(MicrofeedSubscriber* subscriber, const char* publisher,
 	GHashTable* image_cache;
 
 	if (image_caches && (image_cache = (GHashTable*)g_hash_table_lookup(image_caches, publisher))) {
-		if ((image = gdk_pixbuf_new_from_file_at_size(path, 51, 51, NULL))) {
+		if ((image = gdk_pixbuf_new_from_file_at_size(path, MAUKU_ATLAS_SLOT_SIZE, MAUKU_ATLAS_SLOT_SIZE, NULL))) {
 			g_hash_table_replace(image_cache, g_strdup(url), image);
 		}
 	}
@@ -103,9 +108,15 @@ static void add_view_feed(gpointer key, gpointer value, gpointer user_data) {
 }
 
 static void open_overview(void) {
+	MaukuViewRetention retention = { OVERVIEW_MAX_ITEMS, OVERVIEW_MAX_AGE, OVERVIEW_MAX_BYTES };
+
 	microfeed_subscriber_handle_configured_subscriptions(subscriber, configured_subscribe, configured_unsubscribe, NULL);
 	if (!overview_view) {
 		overview_view = mauku_view_new("Overview", TRUE);
+		mauku_view_set_cached(overview_view, TRUE);
+		mauku_view_set_retention(overview_view, &retention);
+		mauku_view_set_collapse_conversations(overview_view, TRUE);
+		mauku_view_set_fold_copies(overview_view, TRUE);
 		g_hash_table_foreach(image_caches, add_view_feed, overview_view);
 	}
 	mauku_view_show(overview_view);
@@ -0,0 +1,144 @@
+/* Mauku 2.0 (c) Henrik Hedberg <hhedberg@innologies.fi> 
+   You are NOT allowed to modify or redistribute the source code. */
+
+#include "mauku-atlas.h"
+#include "mauku-upload.h"
+
+/* Avatars are uploaded once into slots of a single server-side pixmap and copied from there
+   with gdk_draw_drawable. A slot is freed when its pixbuf is finalized, and the least recently
+   used one is evicted when the atlas is full. Pixbufs that are not opaque are not atlased,
+   since they would have to be composited against the background of each item. */
+
+#define ATLAS_COLUMNS 10
+#define ATLAS_ROWS 10
+#define SLOT_COUNT (ATLAS_COLUMNS * ATLAS_ROWS)
+#define NOT_ATLASED G_MAXUINT
+
+typedef struct {
+	GdkPixbuf* pixbuf;
+	gint width;
+	gint height;
+	guint last_used;
+} Slot;
+
+static GdkPixmap* atlas;
+static GdkGC* atlas_gc;
+static Slot slots[SLOT_COUNT];
+static GHashTable* slot_indices;
+static guint use_counter;
+
+static guint allocate_slot(GdkPixbuf* pixbuf);
+static void free_slot(guint index);
+static gboolean is_opaque(GdkPixbuf* pixbuf);
+static void on_pixbuf_finalized(gpointer data, GObject* where_the_object_was);
+
+gboolean mauku_atlas_draw_pixbuf(GdkDrawable* drawable, GdkGC* gc, GdkPixbuf* pixbuf, gint x, gint y) {
+	gpointer value;
+	guint index;
+
+	g_return_val_if_fail(GDK_IS_DRAWABLE(drawable), FALSE);
+	g_return_val_if_fail(GDK_IS_PIXBUF(pixbuf), FALSE);
+
+	if (!atlas) {
+		atlas = gdk_pixmap_new(drawable, ATLAS_COLUMNS * MAUKU_ATLAS_SLOT_SIZE, ATLAS_ROWS * MAUKU_ATLAS_SLOT_SIZE, -1);
+		atlas_gc = gdk_gc_new(atlas);
+		slot_indices = g_hash_table_new(g_direct_hash, g_direct_equal);
+	} else if (gdk_drawable_get_depth(drawable) != gdk_drawable_get_depth(atlas)) {
+
+		return FALSE;
+	}
+
+	if (g_hash_table_lookup_extended(slot_indices, pixbuf, NULL, &value)) {
+		index = GPOINTER_TO_UINT(value);
+	} else {
+		if (gdk_pixbuf_get_width(pixbuf) > MAUKU_ATLAS_SLOT_SIZE || gdk_pixbuf_get_height(pixbuf) > MAUKU_ATLAS_SLOT_SIZE || !is_opaque(pixbuf)) {
+			index = NOT_ATLASED;
+		} else {
+			index = allocate_slot(pixbuf);
+			mauku_upload_pixbuf(atlas, atlas_gc, pixbuf, 0, 0,
+			                    (index % ATLAS_COLUMNS) * MAUKU_ATLAS_SLOT_SIZE, (index / ATLAS_COLUMNS) * MAUKU_ATLAS_SLOT_SIZE,
+			                    slots[index].width, slots[index].height);
+		}
+		g_hash_table_insert(slot_indices, pixbuf, GUINT_TO_POINTER(index));
+		g_object_weak_ref(G_OBJECT(pixbuf), on_pixbuf_finalized, NULL);
+	}
+	if (index == NOT_ATLASED) {
+
+		return FALSE;
+	}
+
+	slots[index].last_used = ++use_counter;
+	gdk_draw_drawable(drawable, gc, atlas,
+	                  (index % ATLAS_COLUMNS) * MAUKU_ATLAS_SLOT_SIZE, (index / ATLAS_COLUMNS) * MAUKU_ATLAS_SLOT_SIZE,
+	                  x, y, slots[index].width, slots[index].height);
+
+	return TRUE;
+}
+
+static guint allocate_slot(GdkPixbuf* pixbuf) {
+	guint index;
+	guint i;
+
+	index = 0;
+	for (i = 0; i < SLOT_COUNT; i++) {
+		if (!slots[i].pixbuf) {
+			index = i;
+			break;
+		} else if (slots[i].last_used < slots[index].last_used) {
+			index = i;
+		}
+	}
+	if (slots[index].pixbuf) {
+		g_object_weak_unref(G_OBJECT(slots[index].pixbuf), on_pixbuf_finalized, NULL);
+		g_hash_table_remove(slot_indices, slots[index].pixbuf);
+		free_slot(index);
+	}
+
+	slots[index].pixbuf = pixbuf;
+	slots[index].width = gdk_pixbuf_get_width(pixbuf);
+	slots[index].height = gdk_pixbuf_get_height(pixbuf);
+	slots[index].last_used = use_counter;
+
+	return index;
+}
+
+static void free_slot(guint index) {
+	slots[index].pixbuf = NULL;
+	slots[index].width = 0;
+	slots[index].height = 0;
+	slots[index].last_used = 0;
+}
+
+static gboolean is_opaque(GdkPixbuf* pixbuf) {
+	gboolean opaque = TRUE;
+	const guchar* row;
+	gint x;
+	gint y;
+
+	if (gdk_pixbuf_get_has_alpha(pixbuf)) {
+		for (y = 0; opaque && y < gdk_pixbuf_get_height(pixbuf); y++) {
+			row = gdk_pixbuf_get_pixels(pixbuf) + y * gdk_pixbuf_get_rowstride(pixbuf);
+			for (x = 0; x < gdk_pixbuf_get_width(pixbuf); x++) {
+				if (row[x * 4 + 3] != 0xff) {
+					opaque = FALSE;
+					break;
+				}
+			}
+		}
+	}
+
+	return opaque;
+}
+
+static void on_pixbuf_finalized(gpointer data, GObject* where_the_object_was) {
+	gpointer value;
+	guint index;
+
+	if (g_hash_table_lookup_extended(slot_indices, where_the_object_was, NULL, &value)) {
+		index = GPOINTER_TO_UINT(value);
+		if (index != NOT_ATLASED) {
+			free_slot(index);
+		}
+		g_hash_table_remove(slot_indices, where_the_object_was);
+	}
+}
@@ -0,0 +1,13 @@
+/* Mauku 2.0 (c) Henrik Hedberg <hhedberg@innologies.fi> 
+   You are NOT allowed to modify or redistribute the source code. */
+
+#ifndef __MAUKU_ATLAS_H__
+#define __MAUKU_ATLAS_H__
+
+#include <gtk/gtk.h>
+
+#define MAUKU_ATLAS_SLOT_SIZE 51
+
+gboolean mauku_atlas_draw_pixbuf(GdkDrawable* drawable, GdkGC* gc, GdkPixbuf* pixbuf, gint x, gint y);
+
+#endif
@@ -0,0 +1,552 @@
+/* Mauku 2.0 (c) Henrik Hedberg <hhedberg@innologies.fi> 
+   You are NOT allowed to modify or redistribute the source code. */
+
+#include "mauku-cache.h"
+#include <microfeed-common/microfeedprotocol.h>
+#include <glib/gstdio.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#define CACHE_MAGIC 0x4355414d /* "MAUC" */
+#define CACHE_VERSION 2
+#define CACHE_MAX_BYTES (512 * 1024)
+#define CACHE_MAX_FILE_BYTES (2 * CACHE_MAX_BYTES)
+#define CACHE_NULL_STRING 0xffffffff
+#define CACHE_STATUS_REMOVED 0x80000000
+#define ALIGN(size) (((size) + 7) & ~(gsize)7)
+
+/* The file is a header followed by self-delimiting records in host byte order, so that it can be used
+   in place through a mapping. Each record is checksummed and its size is a multiple of 8, so that every
+   record starts aligned; reading stops at the first record that does not check out, which drops a torn tail.
+   Changed records are appended to the file, and a removed one gets an appended record without content.
+   The last copy of an item wins. The file is compacted, that is replaced as a whole with rename(), when
+   it grows over its cap or has more superseded bytes than live ones. The mapping of the old contents is
+   dropped after each write so that the next load maps the new ones. */
+typedef struct {
+	guint32 magic;
+	guint32 version;
+	guint32 n_records;
+	guint32 reserved;
+} Header;
+
+enum {
+	STRING_PUBLISHER,
+	STRING_URI,
+	STRING_UID,
+	STRING_TEXT,
+	STRING_SENDER,
+	STRING_SENDER_URI,
+	STRING_AVATAR_UID,
+	STRING_COMMENTS_URI,
+	STRING_REFERRED_UID,
+	STRING_REFERRED_URI,
+	STRING_LINK,
+	STRING_COUNT
+};
+
+typedef struct {
+	guint32 size;
+	guint32 checksum;
+	gint64 timestamp;
+	guint32 status;
+	guint32 comments;
+	guint32 height;
+	guint32 height_width;
+	guint32 lengths[STRING_COUNT];
+	/* STRING_COUNT nul-terminated strings follow, NULL ones omitted. */
+} Record;
+
+/* The last copy of each item in the file, keyed by its publisher, feed and uid. */
+typedef struct {
+	guint32 offset;
+	guint32 size;
+	guint32 checksum;
+	gboolean removed;
+} Slot;
+
+static void load(const gchar* publisher, const gchar* uri, gboolean related, MaukuCacheRecordFunc func, gpointer user_data);
+static gchar* get_path(void);
+static GMappedFile* get_mapped_file(void);
+static void build_index(void);
+static void free_index(void);
+static gchar* get_key(const gchar* publisher, const gchar* uri, const gchar* uid);
+static void set_slot(gchar* key, gsize offset, gsize size, guint32 checksum, gboolean removed);
+static const Record* read_record(const gchar* data, gsize length, gsize offset, const gchar* strings[STRING_COUNT]);
+static guint32 checksum(const guchar* data, gsize length);
+static gboolean read_strings(const Record* record, const gchar* strings[STRING_COUNT]);
+static MicrofeedItem* create_microfeed_item(const Record* record, const gchar* strings[STRING_COUNT]);
+static gsize append_record(GString* string, MaukuFeedRecord* record, gboolean removed, gsize limit);
+static void append_record_data(GString* string, Record* header, const gchar* strings[STRING_COUNT], gsize size, MaukuFeedRecord* record, gboolean removed);
+static gboolean write_file(FILE* file, GString* string);
+static void drop_mapped_file(void);
+
+static GMappedFile* mapped_file = NULL;
+static gboolean mapped_file_tried = FALSE;
+static GHashTable* slots = NULL;
+static gsize file_length = 0;
+static gsize live_bytes = 0;
+
+/* Creates (or references) a feed store record for the last cached copy of each item of the feed, and
+   passes it to the function, which takes over the reference. */
+void mauku_cache_load_feed(const gchar* publisher, const gchar* uri, MaukuCacheRecordFunc func, gpointer user_data) {
+	load(publisher, uri, FALSE, func, user_data);
+}
+
+/* As above, but for the cached items that are related to the feed as in mauku_feed_store_foreach_related(). */
+void mauku_cache_load_related(const gchar* publisher, const gchar* uri, MaukuCacheRecordFunc func, gpointer user_data) {
+	load(publisher, uri, TRUE, func, user_data);
+}
+
+static void load(const gchar* publisher, const gchar* uri, gboolean related, MaukuCacheRecordFunc func, gpointer user_data) {
+	GMappedFile* file;
+	const gchar* data;
+	gsize length;
+	gsize offset;
+	const Record* record;
+	const gchar* strings[STRING_COUNT];
+	gchar* key;
+	Slot* slot;
+	MicrofeedItem* item;
+	MaukuFeedRecord* feed_record;
+
+	if (!slots) {
+		build_index();
+	}
+	if ((file = get_mapped_file())) {
+		data = g_mapped_file_get_contents(file);
+		length = MIN(g_mapped_file_get_length(file), file_length);
+		for (offset = sizeof(Header); (record = read_record(data, length, offset, strings)); offset += record->size) {
+			if (!(record->status & CACHE_STATUS_REMOVED) && !strcmp(strings[STRING_PUBLISHER], publisher) &&
+			    (!strcmp(strings[STRING_URI], uri) ||
+			     (related && ((strings[STRING_SENDER_URI] && !strcmp(strings[STRING_SENDER_URI], uri)) ||
+			                  (strings[STRING_COMMENTS_URI] && !strcmp(strings[STRING_COMMENTS_URI], uri)) ||
+			                  (strings[STRING_REFERRED_URI] && !strcmp(strings[STRING_REFERRED_URI], uri)))))) {
+				/* Only the last copy of an item counts. */
+				key = get_key(strings[STRING_PUBLISHER], strings[STRING_URI], strings[STRING_UID]);
+				slot = (Slot*)g_hash_table_lookup(slots, key);
+				g_free(key);
+				if (slot && slot->offset == offset) {
+					item = create_microfeed_item(record, strings);
+					feed_record = mauku_feed_store_get_record(publisher, strings[STRING_URI], item);
+					if (!feed_record->height) {
+						mauku_feed_record_set_height(feed_record, record->height_width, record->height);
+					}
+					microfeed_item_free(item);
+					func(feed_record, user_data);
+				}
+			}
+		}
+	}
+}
+
+/* Appends the given records that differ from their last copy in the file, and a removal for the removed ones
+   that are in the file. Returns FALSE without writing anything if the file should be compacted instead with
+   mauku_cache_write(). */
+gboolean mauku_cache_append(MaukuFeedRecord** records, guint n_records, MaukuFeedRecord** removed, guint n_removed) {
+	gboolean retvalue = FALSE;
+	GString* string;
+	GPtrArray* keys;
+	GArray* offsets;
+	gboolean full = FALSE;
+	MaukuFeedRecord* record;
+	gchar* key;
+	Slot* slot;
+	gsize offset;
+	gsize size;
+	gchar* path;
+	FILE* file;
+	guint i;
+
+	if (!slots) {
+		build_index();
+	}
+	if (file_length && file_length - sizeof(Header) - live_bytes <= live_bytes) {
+		string = g_string_new(NULL);
+		keys = g_ptr_array_new();
+		offsets = g_array_new(FALSE, FALSE, sizeof(gsize));
+		for (i = 0; !full && i < n_records + n_removed; i++) {
+			record = (i < n_records ? records[i] : removed[i - n_records]);
+			key = get_key(record->publisher, record->uri, record->uid);
+			slot = (Slot*)g_hash_table_lookup(slots, key);
+			offset = string->len;
+			if (i >= n_records && (!slot || slot->removed)) {
+				/* Never written or already removed. */
+				size = 0;
+			} else if (!(size = append_record(string, record, i >= n_records, CACHE_MAX_FILE_BYTES - file_length - string->len))) {
+				full = TRUE;
+			} else if (i < n_records && slot && !slot->removed && slot->checksum == ((const Record*)(string->str + offset))->checksum) {
+				/* Unchanged. */
+				g_string_truncate(string, offset);
+				size = 0;
+			}
+			if (size) {
+				g_ptr_array_add(keys, key);
+				g_array_append_val(offsets, offset);
+			} else {
+				g_free(key);
+			}
+		}
+
+		if (!full) {
+			retvalue = TRUE;
+			if (string->len) {
+				path = get_path();
+				/* A torn tail from an earlier write is cleaned up by compacting. */
+				if ((file = fopen(path, "r+b")) && fseek(file, 0, SEEK_END) == 0 && ftell(file) == (long)file_length) {
+					retvalue = write_file(file, string);
+				} else {
+					retvalue = FALSE;
+					if (file) {
+						fclose(file);
+					}
+				}
+				if (retvalue) {
+					printf("MaukuCache: appended %u records, %u bytes\n", keys->len, (guint)string->len);
+					for (i = 0; i < keys->len; i++) {
+						offset = g_array_index(offsets, gsize, i);
+						set_slot((gchar*)keys->pdata[i], file_length + offset, ((const Record*)(string->str + offset))->size,
+						         ((const Record*)(string->str + offset))->checksum,
+						         (((const Record*)(string->str + offset))->status & CACHE_STATUS_REMOVED ? TRUE : FALSE));
+					}
+					g_ptr_array_set_size(keys, 0);
+					file_length += string->len;
+				} else {
+					fprintf(stderr, "MaukuCache: could not append to %s\n", path);
+					free_index();
+				}
+				drop_mapped_file();
+				g_free(path);
+			}
+		}
+		for (i = 0; i < keys->len; i++) {
+			g_free(keys->pdata[i]);
+		}
+		g_ptr_array_free(keys, TRUE);
+		g_array_free(offsets, TRUE);
+		g_string_free(string, TRUE);
+	}
+
+	return retvalue;
+}
+
+/* Compacts the cache by replacing it with the given records, newest first, until the size cap is reached. */
+void mauku_cache_write(MaukuFeedRecord** records, guint n_records) {
+	GString* string;
+	Header header;
+	gchar* path;
+	gchar* temporary_path;
+	FILE* file;
+	gboolean success = FALSE;
+	gsize offset;
+	const Record* record;
+	const gchar* strings[STRING_COUNT];
+	guint i;
+
+	header.magic = CACHE_MAGIC;
+	header.version = CACHE_VERSION;
+	header.n_records = 0;
+	header.reserved = 0;
+	string = g_string_sized_new(CACHE_MAX_BYTES / 4);
+	g_string_append_len(string, (const gchar*)&header, sizeof(Header));
+	for (i = 0; i < n_records; i++) {
+		if (!append_record(string, records[i], FALSE, CACHE_MAX_BYTES - string->len)) {
+			break;
+		}
+		header.n_records++;
+	}
+	memcpy(string->str, &header, sizeof(Header));
+
+	path = get_path();
+	temporary_path = g_strconcat(path, ".tmp", NULL);
+	if ((file = fopen(temporary_path, "wb"))) {
+		success = write_file(file, string);
+	}
+	free_index();
+	if (success && g_rename(temporary_path, path) == 0) {
+		printf("MaukuCache: wrote %u records, %u bytes\n", header.n_records, (guint)string->len);
+		slots = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+		file_length = string->len;
+		for (offset = sizeof(Header); offset < string->len; offset += ((const Record*)(string->str + offset))->size) {
+			record = (const Record*)(string->str + offset);
+			read_strings(record, strings);
+			set_slot(get_key(strings[STRING_PUBLISHER], strings[STRING_URI], strings[STRING_UID]), offset, record->size, record->checksum, FALSE);
+		}
+	} else {
+		g_unlink(temporary_path);
+		fprintf(stderr, "MaukuCache: could not write %s\n", path);
+	}
+	drop_mapped_file();
+	g_free(temporary_path);
+	g_free(path);
+	g_string_free(string, TRUE);
+}
+
+static gchar* get_path(void) {
+	gchar* directory;
+	gchar* path;
+
+	directory = g_build_filename(g_get_home_dir(), ".mauku", NULL);
+	g_mkdir_with_parents(directory, 0700);
+	path = g_build_filename(directory, "timeline.cache", NULL);
+	g_free(directory);
+
+	return path;
+}
+
+/* The file is mapped at the first load after start or after a write, and kept mapped until the next write. */
+static GMappedFile* get_mapped_file(void) {
+	gchar* path;
+	const Header* header;
+
+	if (!mapped_file_tried) {
+		mapped_file_tried = TRUE;
+		path = get_path();
+		if ((mapped_file = g_mapped_file_new(path, FALSE, NULL))) {
+			header = (const Header*)g_mapped_file_get_contents(mapped_file);
+			if (g_mapped_file_get_length(mapped_file) < sizeof(Header) || header->magic != CACHE_MAGIC || header->version != CACHE_VERSION) {
+				printf("MaukuCache: ignoring %s with unknown format\n", path);
+				g_mapped_file_free(mapped_file);
+				mapped_file = NULL;
+			}
+		}
+		g_free(path);
+	}
+
+	return mapped_file;
+}
+
+/* Walks the file once to find the last copy of each item and the end of the valid records. */
+static void build_index(void) {
+	GMappedFile* file;
+	const gchar* data;
+	gsize length;
+	const Record* record;
+	const gchar* strings[STRING_COUNT];
+
+	slots = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+	file_length = 0;
+	live_bytes = 0;
+	if ((file = get_mapped_file())) {
+		data = g_mapped_file_get_contents(file);
+		length = g_mapped_file_get_length(file);
+		for (file_length = sizeof(Header); (record = read_record(data, length, file_length, strings)); file_length += record->size) {
+			set_slot(get_key(strings[STRING_PUBLISHER], strings[STRING_URI], strings[STRING_UID]), file_length, record->size,
+			         record->checksum, (record->status & CACHE_STATUS_REMOVED ? TRUE : FALSE));
+		}
+		if (file_length < length) {
+			printf("MaukuCache: dropping %u damaged bytes\n", (guint)(length - file_length));
+		}
+	}
+}
+
+static void free_index(void) {
+	if (slots) {
+		g_hash_table_destroy(slots);
+		slots = NULL;
+	}
+	file_length = 0;
+	live_bytes = 0;
+}
+
+static gchar* get_key(const gchar* publisher, const gchar* uri, const gchar* uid) {
+
+	return g_strconcat(publisher, "\n", uri, "\n", uid, NULL);
+}
+
+/* Takes over the key. */
+static void set_slot(gchar* key, gsize offset, gsize size, guint32 checksum, gboolean removed) {
+	Slot* slot;
+
+	if ((slot = (Slot*)g_hash_table_lookup(slots, key))) {
+		if (!slot->removed) {
+			live_bytes -= slot->size;
+		}
+		g_free(key);
+	} else {
+		slot = g_new(Slot, 1);
+		g_hash_table_insert(slots, key, slot);
+	}
+	slot->offset = offset;
+	slot->size = size;
+	slot->checksum = checksum;
+	slot->removed = removed;
+	if (!removed) {
+		live_bytes += size;
+	}
+}
+
+/* Returns the record at the offset, or NULL at the end or at a damaged record. A size that is not a multiple
+   of 8 would leave the next record misaligned, so it is damage too. */
+static const Record* read_record(const gchar* data, gsize length, gsize offset, const gchar* strings[STRING_COUNT]) {
+	const Record* record = NULL;
+
+	if (offset + sizeof(Record) <= length) {
+		record = (const Record*)(data + offset);
+		if (record->size < sizeof(Record) || record->size > length - offset || (record->size & 7) ||
+		    record->checksum != checksum((const guchar*)record + 2 * sizeof(guint32), record->size - 2 * sizeof(guint32)) ||
+		    !read_strings(record, strings)) {
+			record = NULL;
+		}
+	}
+
+	return record;
+}
+
+static gboolean write_file(FILE* file, GString* string) {
+	gboolean success;
+
+	success = (fwrite(string->str, string->len, 1, file) == 1 && fflush(file) == 0 && fsync(fileno(file)) == 0);
+
+	return (fclose(file) == 0 && success);
+}
+
+static void drop_mapped_file(void) {
+	if (mapped_file) {
+		g_mapped_file_free(mapped_file);
+		mapped_file = NULL;
+	}
+	mapped_file_tried = FALSE;
+}
+
+/* FNV-1a. */
+static guint32 checksum(const guchar* data, gsize length) {
+	guint32 hash = 2166136261U;
+	gsize i;
+
+	for (i = 0; i < length; i++) {
+		hash = (hash ^ data[i]) * 16777619U;
+	}
+
+	return hash;
+}
+
+static gboolean read_strings(const Record* record, const gchar* strings[STRING_COUNT]) {
+	gboolean valid = TRUE;
+	const gchar* data;
+	const gchar* end;
+	guint i;
+
+	data = (const gchar*)record + sizeof(Record);
+	end = (const gchar*)record + record->size;
+	for (i = 0; valid && i < STRING_COUNT; i++) {
+		if (record->lengths[i] == CACHE_NULL_STRING) {
+			strings[i] = NULL;
+		} else if (record->lengths[i] < end - data && data[record->lengths[i]] == 0) {
+			strings[i] = data;
+			data += record->lengths[i] + 1;
+		} else {
+			valid = FALSE;
+		}
+	}
+
+	return valid && strings[STRING_PUBLISHER] && strings[STRING_URI] && strings[STRING_UID];
+}
+
+static MicrofeedItem* create_microfeed_item(const Record* record, const gchar* strings[STRING_COUNT]) {
+	MicrofeedItem* item;
+	gchar* s;
+
+	item = microfeed_item_new_with_status(strings[STRING_UID], (time_t)record->timestamp, record->status);
+	if (strings[STRING_TEXT]) {
+		microfeed_item_set_property(item, MICROFEED_ITEM_PROPERTY_NAME_CONTENT_TEXT, strings[STRING_TEXT]);
+	}
+	if (strings[STRING_SENDER]) {
+		microfeed_item_set_property(item, MICROFEED_ITEM_PROPERTY_NAME_USER_NICK, strings[STRING_SENDER]);
+	}
+	if (strings[STRING_SENDER_URI]) {
+		microfeed_item_set_property(item, MICROFEED_ITEM_PROPERTY_NAME_USER_FEED, strings[STRING_SENDER_URI]);
+	}
+	if (strings[STRING_AVATAR_UID]) {
+		microfeed_item_set_property(item, MICROFEED_ITEM_PROPERTY_NAME_USER_IMAGE, strings[STRING_AVATAR_UID]);
+	}
+	if (strings[STRING_COMMENTS_URI]) {
+		microfeed_item_set_property(item, MICROFEED_ITEM_PROPERTY_NAME_COMMENTS_FEED, strings[STRING_COMMENTS_URI]);
+	}
+	if (strings[STRING_REFERRED_UID]) {
+		microfeed_item_set_property(item, MICROFEED_ITEM_PROPERTY_NAME_REFERRED_ITEM, strings[STRING_REFERRED_UID]);
+	}
+	if (strings[STRING_REFERRED_URI]) {
+		microfeed_item_set_property(item, MICROFEED_ITEM_PROPERTY_NAME_REFERRED_FEED, strings[STRING_REFERRED_URI]);
+	}
+	if (strings[STRING_LINK]) {
+		microfeed_item_set_property(item, MICROFEED_ITEM_PROPERTY_NAME_USER_URL, strings[STRING_LINK]);
+	}
+	if (record->comments) {
+		s = g_strdup_printf("%u", record->comments);
+		microfeed_item_set_property(item, MICROFEED_ITEM_PROPERTY_NAME_COMMENTS_COUNT, s);
+		g_free(s);
+	}
+
+	return item;
+}
+
+/* Returns the size of the appended record, or 0 if it would be over the limit. A removed record keeps only
+   the strings that identify it. */
+static gsize append_record(GString* string, MaukuFeedRecord* record, gboolean removed, gsize limit) {
+	Record header;
+	const gchar* strings[STRING_COUNT];
+	gsize size;
+	guint i;
+
+	strings[STRING_PUBLISHER] = record->publisher;
+	strings[STRING_URI] = record->uri;
+	strings[STRING_UID] = record->uid;
+	strings[STRING_TEXT] = record->text;
+	strings[STRING_SENDER] = record->sender;
+	strings[STRING_SENDER_URI] = record->sender_uri;
+	strings[STRING_AVATAR_UID] = record->avatar_uid;
+	strings[STRING_COMMENTS_URI] = record->comments_uri;
+	strings[STRING_REFERRED_UID] = record->referred_uid;
+	strings[STRING_REFERRED_URI] = record->referred_uri;
+	strings[STRING_LINK] = record->link;
+	if (removed) {
+		for (i = STRING_TEXT; i < STRING_COUNT; i++) {
+			strings[i] = NULL;
+		}
+	}
+
+	memset(&header, 0, sizeof(Record));
+	size = sizeof(Record);
+	for (i = 0; i < STRING_COUNT; i++) {
+		if (strings[i]) {
+			header.lengths[i] = strlen(strings[i]);
+			size += header.lengths[i] + 1;
+		} else {
+			header.lengths[i] = CACHE_NULL_STRING;
+		}
+	}
+	size = ALIGN(size);
+	if (size <= limit) {
+		append_record_data(string, &header, strings, size, record, removed);
+	} else {
+		size = 0;
+	}
+
+	return size;
+}
+
+static void append_record_data(GString* string, Record* header, const gchar* strings[STRING_COUNT], gsize size, MaukuFeedRecord* record, gboolean removed) {
+	gsize offset;
+	guint i;
+
+	header->size = size;
+	header->timestamp = record->timestamp;
+	header->status = (record->marked ? MICROFEED_ITEM_STATUS_MARKED : 0) | (record->unread ? MICROFEED_ITEM_STATUS_UNREAD : 0) |
+	                 (removed ? CACHE_STATUS_REMOVED : 0);
+	header->comments = record->comments;
+	header->height = record->height;
+	header->height_width = record->height_width;
+
+	offset = string->len;
+	g_string_append_len(string, (const gchar*)header, sizeof(Record));
+	for (i = 0; i < STRING_COUNT; i++) {
+		if (strings[i]) {
+			g_string_append_len(string, strings[i], header->lengths[i] + 1);
+		}
+	}
+	while (string->len < offset + size) {
+		g_string_append_c(string, 0);
+	}
+	((Record*)(string->str + offset))->checksum = checksum((const guchar*)string->str + offset + 2 * sizeof(guint32), size - 2 * sizeof(guint32));
+}
@@ -0,0 +1,17 @@
+/* Mauku 2.0 (c) Henrik Hedberg <hhedberg@innologies.fi> 
+   You are NOT allowed to modify or redistribute the source code. */
+
+#ifndef __MAUKU_CACHE_H__
+#define __MAUKU_CACHE_H__
+
+#include <glib.h>
+#include "mauku-feed-store.h"
+
+typedef void (*MaukuCacheRecordFunc)(MaukuFeedRecord* record, gpointer user_data);
+
+void mauku_cache_load_feed(const gchar* publisher, const gchar* uri, MaukuCacheRecordFunc func, gpointer user_data);
+void mauku_cache_load_related(const gchar* publisher, const gchar* uri, MaukuCacheRecordFunc func, gpointer user_data);
+gboolean mauku_cache_append(MaukuFeedRecord** records, guint n_records, MaukuFeedRecord** removed, guint n_removed);
+void mauku_cache_write(MaukuFeedRecord** records, guint n_records);
+
+#endif
@@ -69,8 +69,7 @@ static void on_dialog_response(GtkDialog* dialog, gint response_id, gpointer use
 	if (response_id == GTK_RESPONSE_OK &&
 	    hildon_touch_selector_get_selected(HILDON_TOUCH_SELECTOR(contacts->touch_selector), 0, &iter)) {
 		gtk_tree_model_get(GTK_TREE_MODEL(contacts->list_store), &iter,  3, &nick, 0, &publisher, 1, &uri, -1);
-		view = mauku_view_new(nick, FALSE);
-		mauku_view_add_feed(view, publisher, uri);
+		view = mauku_view_open(nick, publisher, uri);
 		mauku_view_show(view);
 	}
 	
@@ -0,0 +1,490 @@
+/* Mauku 2.0 (c) Henrik Hedberg <hhedberg@innologies.fi> 
+   You are NOT allowed to modify or redistribute the source code. */
+
+#include "mauku.h"
+#include "mauku-feed-store.h"
+#include "mauku-intern.h"
+#include <microfeed-common/microfeedprotocol.h>
+#include <string.h>
+#include <stdlib.h>
+
+#define PAGE_SIZE 16384
+#define ALIGN(size) (((size) + 7) & ~(gsize)7)
+
+typedef struct {
+	MaukuFeedRecordChangedCallback callback;
+	gpointer user_data;
+} Listener;
+
+/* A feed is freed with its last page. */
+typedef struct {
+	const gchar* publisher;
+	const gchar* uri;
+	MaukuFeedPage* current_page;
+	guint n_pages;
+} Feed;
+
+/* Records are bump-allocated from the page; the page is freed when its last record is. Records are
+   referenced by address everywhere, so they cannot be moved to compact a page: one long-lived record
+   (a marked item, or one held by a parked view) keeps its whole page allocated. */
+struct _MaukuFeedPage {
+	Feed* feed;
+	gsize size;
+	gsize used;
+	guint live_records;
+};
+
+static guint record_hash(gconstpointer key);
+static gboolean record_equal(gconstpointer a, gconstpointer b);
+static void notify_listeners(MaukuFeedRecord* record, MaukuFeedRecordChanges changes);
+static gboolean is_word_char(gchar c);
+static guint get_url_prefix_length(const gchar* s);
+static GArray* tokenize(const gchar* text);
+static Feed* get_feed(const gchar* publisher, const gchar* uri);
+static gpointer allocate_record(Feed* feed, gsize size);
+static void free_record(MaukuFeedRecord* record);
+static void free_feed(Feed* feed);
+static guint feed_hash(gconstpointer key);
+static gboolean feed_equal(gconstpointer a, gconstpointer b);
+static gchar* copy_string(gchar** destination, const gchar* string, gsize length);
+
+/* Records are not owned by the table: a record removes itself when its last reference is dropped. */
+static GHashTable* records = NULL;
+static GHashTable* feeds = NULL;
+
+MaukuFeedRecord* mauku_feed_store_get_record(const gchar* publisher, const gchar* uri, MicrofeedItem* item) {
+	MaukuFeedRecord* record;
+	const gchar* s;
+	gchar* publisher_part;
+	const gchar* uid;
+	const gchar* text;
+	const gchar* referred_uid;
+	gsize uid_length;
+	gsize text_length;
+	gsize referred_uid_length;
+	GArray* spans;
+	gchar* data;
+
+	uid = microfeed_item_get_uid(item);
+	if ((record = mauku_feed_store_lookup(publisher, uri, uid))) {
+		mauku_feed_record_ref(record);
+	} else {
+		text = microfeed_item_get_property(item, MICROFEED_ITEM_PROPERTY_NAME_CONTENT_TEXT);
+		referred_uid = microfeed_item_get_property(item, MICROFEED_ITEM_PROPERTY_NAME_REFERRED_ITEM);
+		uid_length = strlen(uid) + 1;
+		text_length = (text ? strlen(text) + 1 : 0);
+		referred_uid_length = (referred_uid ? strlen(referred_uid) + 1 : 0);
+		spans = tokenize(text);
+
+		data = allocate_record(get_feed(publisher, uri), ALIGN(sizeof(MaukuFeedRecord)) + ALIGN(spans->len * sizeof(MaukuItemSpan)) +
+		                       uid_length + text_length + referred_uid_length);
+		record = (MaukuFeedRecord*)data;
+		data += ALIGN(sizeof(MaukuFeedRecord));
+		if (spans->len) {
+			memcpy(data, spans->data, spans->len * sizeof(MaukuItemSpan));
+			record->spans = (MaukuItemSpan*)data;
+			record->n_spans = spans->len;
+			data += ALIGN(spans->len * sizeof(MaukuItemSpan));
+		}
+		g_array_free(spans, TRUE);
+		record->uid = copy_string(&data, uid, uid_length);
+		record->text = copy_string(&data, text, text_length);
+		record->referred_uid = copy_string(&data, referred_uid, referred_uid_length);
+
+		record->ref_count = 1;
+		record->publisher = mauku_intern_string(publisher);
+		if ((s = strchr(publisher, MICROFEED_PUBLISHER_IDENTIFIER_SEPARATOR_CHAR))) {
+			publisher_part = g_strndup(publisher, s - publisher);
+			record->publisher_part = mauku_intern_string(publisher_part);
+			g_free(publisher_part);
+		} else {
+			record->publisher_part = mauku_intern_string(publisher);
+		}
+		record->uri = mauku_intern_string(uri);
+		if ((s = microfeed_item_get_property(item, MICROFEED_ITEM_PROPERTY_NAME_USER_IMAGE))) {
+			record->avatar_uid = mauku_intern_string(s);
+			if ((record->avatar = image_cache_get_image(publisher, s))) {
+				g_object_ref(record->avatar);
+			}
+		}
+		record->sender = mauku_intern_string(microfeed_item_get_property(item, MICROFEED_ITEM_PROPERTY_NAME_USER_NICK));
+		record->sender_uri = mauku_intern_string(microfeed_item_get_property(item, MICROFEED_ITEM_PROPERTY_NAME_USER_FEED));
+		record->timestamp = microfeed_item_get_timestamp(item);
+		if ((s = microfeed_item_get_property(item, MICROFEED_ITEM_PROPERTY_NAME_COMMENTS_COUNT))) {
+			record->comments = atoi(s);
+		}
+		record->comments_uri = mauku_intern_string(microfeed_item_get_property(item, MICROFEED_ITEM_PROPERTY_NAME_COMMENTS_FEED));
+		record->referred_uri = mauku_intern_string(microfeed_item_get_property(item, MICROFEED_ITEM_PROPERTY_NAME_REFERRED_FEED));
+		record->marked = (microfeed_item_get_status(item) & MICROFEED_ITEM_STATUS_MARKED ? TRUE : FALSE);
+		record->unread = (microfeed_item_get_status(item) & MICROFEED_ITEM_STATUS_UNREAD ? TRUE : FALSE);
+		record->link = mauku_intern_string(microfeed_item_get_property(item, MICROFEED_ITEM_PROPERTY_NAME_USER_URL));
+
+		if (!records) {
+			records = g_hash_table_new(record_hash, record_equal);
+		}
+		g_hash_table_insert(records, record, record);
+	}
+
+	return record;
+}
+
+MaukuFeedRecord* mauku_feed_store_lookup(const gchar* publisher, const gchar* uri, const gchar* uid) {
+	MaukuFeedRecord* record = NULL;
+	MaukuFeedRecord key;
+
+	if (records && (key.publisher = mauku_intern_lookup(publisher)) && (key.uri = mauku_intern_lookup(uri))) {
+		key.uid = (gchar*)uid;
+		record = (MaukuFeedRecord*)g_hash_table_lookup(records, &key);
+	}
+
+	return record;
+}
+
+void mauku_feed_store_set_status(const gchar* publisher, const gchar* uri, const gchar* uid, MicrofeedItemStatus status) {
+	MaukuFeedRecord* record;
+
+	if ((record = mauku_feed_store_lookup(publisher, uri, uid))) {
+		mauku_feed_record_set_status(record, status & MICROFEED_ITEM_STATUS_MARKED, status & MICROFEED_ITEM_STATUS_UNREAD);
+	}
+}
+
+/* Applies the properties of a changed item that can differ from the record, and notifies the listeners
+   about what actually changed. */
+MaukuFeedRecordChanges mauku_feed_store_update_record(MaukuFeedRecord* record, MicrofeedItem* item) {
+	MaukuFeedRecordChanges changes = 0;
+	const gchar* text;
+	const gchar* s;
+	guint comments;
+	gsize text_length;
+	GArray* spans;
+	gchar* data;
+
+	text = microfeed_item_get_property(item, MICROFEED_ITEM_PROPERTY_NAME_CONTENT_TEXT);
+	if (g_strcmp0(text, record->text)) {
+		text_length = (text ? strlen(text) + 1 : 0);
+		spans = tokenize(text);
+		g_free(record->edited_data);
+		data = record->edited_data = g_malloc(ALIGN(spans->len * sizeof(MaukuItemSpan)) + text_length);
+		record->spans = NULL;
+		record->n_spans = spans->len;
+		if (spans->len) {
+			memcpy(data, spans->data, spans->len * sizeof(MaukuItemSpan));
+			record->spans = (MaukuItemSpan*)data;
+			data += ALIGN(spans->len * sizeof(MaukuItemSpan));
+		}
+		g_array_free(spans, TRUE);
+		record->text = copy_string(&data, text, text_length);
+		record->height = record->height_width = 0;
+		changes |= MAUKU_FEED_RECORD_CHANGED_TEXT;
+	}
+	comments = ((s = microfeed_item_get_property(item, MICROFEED_ITEM_PROPERTY_NAME_COMMENTS_COUNT)) ? atoi(s) : 0);
+	if (comments != record->comments) {
+		record->comments = comments;
+		changes |= MAUKU_FEED_RECORD_CHANGED_COMMENTS;
+	}
+	if (record->marked != (microfeed_item_get_status(item) & MICROFEED_ITEM_STATUS_MARKED ? TRUE : FALSE) ||
+	    record->unread != (microfeed_item_get_status(item) & MICROFEED_ITEM_STATUS_UNREAD ? TRUE : FALSE)) {
+		record->marked = (microfeed_item_get_status(item) & MICROFEED_ITEM_STATUS_MARKED ? TRUE : FALSE);
+		record->unread = (microfeed_item_get_status(item) & MICROFEED_ITEM_STATUS_UNREAD ? TRUE : FALSE);
+		changes |= MAUKU_FEED_RECORD_CHANGED_STATUS;
+	}
+	if (changes) {
+		notify_listeners(record, changes);
+	}
+
+	return changes;
+}
+
+/* Passes a new reference to each record of the publisher that is in the feed, was sent by the owner of the feed,
+   or has the feed as its comments or referred feed. These are the items a view of the feed is likely to show. */
+void mauku_feed_store_foreach_related(const gchar* publisher, const gchar* uri, MaukuFeedRecordFunc func, gpointer user_data) {
+	GPtrArray* related;
+	GHashTableIter iter;
+	MaukuFeedRecord* record;
+	guint i;
+
+	if (records && (publisher = mauku_intern_lookup(publisher)) && (uri = mauku_intern_lookup(uri))) {
+		related = g_ptr_array_new();
+		g_hash_table_iter_init(&iter, records);
+		while (g_hash_table_iter_next(&iter, (gpointer*)&record, NULL)) {
+			if (record->publisher == publisher &&
+			    (record->uri == uri || record->sender_uri == uri || record->comments_uri == uri || record->referred_uri == uri)) {
+				g_ptr_array_add(related, mauku_feed_record_ref(record));
+			}
+		}
+		for (i = 0; i < related->len; i++) {
+			func((MaukuFeedRecord*)related->pdata[i], user_data);
+		}
+		g_ptr_array_free(related, TRUE);
+	}
+}
+
+MaukuFeedRecord* mauku_feed_record_ref(MaukuFeedRecord* record) {
+	g_return_val_if_fail(record != NULL, NULL);
+
+	record->ref_count++;
+
+	return record;
+}
+
+void mauku_feed_record_unref(MaukuFeedRecord* record) {
+	g_return_if_fail(record != NULL);
+	g_return_if_fail(record->ref_count > 0);
+
+	if (--record->ref_count == 0) {
+		g_hash_table_remove(records, record);
+		if (record->avatar) {
+			g_object_unref(record->avatar);
+		}
+		mauku_intern_release(record->publisher);
+		mauku_intern_release(record->publisher_part);
+		mauku_intern_release(record->uri);
+		mauku_intern_release(record->avatar_uid);
+		mauku_intern_release(record->sender);
+		mauku_intern_release(record->sender_uri);
+		mauku_intern_release(record->comments_uri);
+		mauku_intern_release(record->referred_uri);
+		mauku_intern_release(record->link);
+		g_list_foreach(record->listeners, (GFunc)g_free, NULL);
+		g_list_free(record->listeners);
+		g_free(record->edited_data);
+		free_record(record);
+	}
+}
+
+void mauku_feed_record_set_status(MaukuFeedRecord* record, gboolean marked, gboolean unread) {
+	marked = (marked ? TRUE : FALSE);
+	unread = (unread ? TRUE : FALSE);
+	if (record->marked != marked || record->unread != unread) {
+		record->marked = marked;
+		record->unread = unread;
+		notify_listeners(record, MAUKU_FEED_RECORD_CHANGED_STATUS);
+	}
+}
+
+void mauku_feed_record_set_avatar(MaukuFeedRecord* record, GdkPixbuf* avatar) {
+	if (record->avatar != avatar) {
+		if (record->avatar) {
+			g_object_unref(record->avatar);
+		}
+		record->avatar = (avatar ? g_object_ref(avatar) : NULL);
+		notify_listeners(record, MAUKU_FEED_RECORD_CHANGED_AVATAR);
+	}
+}
+
+/* The last measured full height of an item at the given width; a hint for laying out the next widget. */
+void mauku_feed_record_set_height(MaukuFeedRecord* record, guint width, guint height) {
+	record->height = MIN(height, G_MAXUINT16);
+	record->height_width = MIN(width, G_MAXUINT16);
+}
+
+void mauku_feed_record_add_listener(MaukuFeedRecord* record, MaukuFeedRecordChangedCallback callback, gpointer user_data) {
+	Listener* listener;
+
+	listener = g_new(Listener, 1);
+	listener->callback = callback;
+	listener->user_data = user_data;
+	record->listeners = g_list_prepend(record->listeners, listener);
+}
+
+void mauku_feed_record_remove_listener(MaukuFeedRecord* record, MaukuFeedRecordChangedCallback callback, gpointer user_data) {
+	GList* list;
+	Listener* listener;
+
+	for (list = record->listeners; list; list = list->next) {
+		listener = (Listener*)list->data;
+		if (listener->callback == callback && listener->user_data == user_data) {
+			record->listeners = g_list_delete_link(record->listeners, list);
+			g_free(listener);
+			break;
+		}
+	}
+}
+
+static guint record_hash(gconstpointer key) {
+	const MaukuFeedRecord* record;
+
+	record = (const MaukuFeedRecord*)key;
+
+	return (g_str_hash(record->uid) * 31 + g_direct_hash(record->uri)) * 31 + g_direct_hash(record->publisher);
+}
+
+static gboolean record_equal(gconstpointer a, gconstpointer b) {
+	const MaukuFeedRecord* record_a;
+	const MaukuFeedRecord* record_b;
+
+	record_a = (const MaukuFeedRecord*)a;
+	record_b = (const MaukuFeedRecord*)b;
+
+	return record_a->uri == record_b->uri &&
+	       record_a->publisher == record_b->publisher &&
+	       !strcmp(record_a->uid, record_b->uid);
+}
+
+static void notify_listeners(MaukuFeedRecord* record, MaukuFeedRecordChanges changes) {
+	GList* list;
+	GList* next;
+	Listener* listener;
+
+	for (list = record->listeners; list; list = next) {
+		next = list->next;
+		listener = (Listener*)list->data;
+		listener->callback(record, changes, listener->user_data);
+	}
+}
+
+static gboolean is_word_char(gchar c) {
+
+	return g_ascii_isalnum(c) || c == '_' || (guchar)c >= 0x80;
+}
+
+static guint get_url_prefix_length(const gchar* s) {
+	guint length = 0;
+
+	if (!strncmp(s, "http://", 7)) {
+		length = 7;
+	} else if (!strncmp(s, "https://", 8)) {
+		length = 8;
+	} else if (!strncmp(s, "www.", 4)) {
+		length = 4;
+	}
+
+	return length;
+}
+
+/* Finds URLs, @mentions and #tags in one pass over the text. */
+static GArray* tokenize(const gchar* text) {
+	GArray* spans;
+	MaukuItemSpan span;
+	const gchar* start;
+	const gchar* end;
+	guint length;
+
+	spans = g_array_new(FALSE, FALSE, sizeof(MaukuItemSpan));
+	if (text) {
+		for (start = text; *start; ) {
+			end = start;
+			if ((length = get_url_prefix_length(start)) && start[length] && !g_ascii_isspace(start[length])) {
+				for (end = start + length; *end; end++) {
+					if (g_ascii_isspace(*end) || *end == ')') {
+						break;
+					}
+				}
+				while (end > start && *(end - 1) == '.') {
+					end--;
+				}
+				span.type = MAUKU_ITEM_SPAN_URL;
+			} else if ((*start == '@' || *start == '#') && (start == text || !is_word_char(*(start - 1)))) {
+				for (end = start + 1; *end && is_word_char(*end); end++) {
+				}
+				if (end == start + 1) {
+					end = start;
+				}
+				span.type = (*start == '@' ? MAUKU_ITEM_SPAN_MENTION : MAUKU_ITEM_SPAN_TAG);
+			}
+			if (end > start) {
+				span.start = start - text;
+				span.end = end - text;
+				g_array_append_val(spans, span);
+				start = end;
+			} else {
+				start++;
+			}
+		}
+	}
+
+	return spans;
+}
+
+static Feed* get_feed(const gchar* publisher, const gchar* uri) {
+	Feed* feed;
+	Feed key;
+
+	if (!feeds) {
+		feeds = g_hash_table_new(feed_hash, feed_equal);
+	}
+	key.publisher = mauku_intern_lookup(publisher);
+	key.uri = mauku_intern_lookup(uri);
+	if (!key.publisher || !key.uri || !(feed = (Feed*)g_hash_table_lookup(feeds, &key))) {
+		feed = g_new0(Feed, 1);
+		feed->publisher = mauku_intern_string(publisher);
+		feed->uri = mauku_intern_string(uri);
+		g_hash_table_insert(feeds, feed, feed);
+	}
+
+	return feed;
+}
+
+/* Bump-allocates a zeroed block from the current page of the feed, starting a new page when it is full.
+   A block that does not fit in an empty page gets a page of its own. */
+static gpointer allocate_record(Feed* feed, gsize size) {
+	MaukuFeedPage* page;
+	gpointer data;
+
+	size = ALIGN(size);
+	if (!(page = feed->current_page) || page->used + size > page->size) {
+		page = (MaukuFeedPage*)g_malloc(MAX(PAGE_SIZE, ALIGN(sizeof(MaukuFeedPage)) + size));
+		page->feed = feed;
+		page->size = MAX(PAGE_SIZE, ALIGN(sizeof(MaukuFeedPage)) + size);
+		page->used = ALIGN(sizeof(MaukuFeedPage));
+		page->live_records = 0;
+		feed->current_page = page;
+		feed->n_pages++;
+	}
+	data = (gchar*)page + page->used;
+	memset(data, 0, size);
+	page->used += size;
+	page->live_records++;
+	((MaukuFeedRecord*)data)->page = page;
+
+	return data;
+}
+
+static void free_record(MaukuFeedRecord* record) {
+	MaukuFeedPage* page;
+	Feed* feed;
+
+	page = record->page;
+	if (--page->live_records == 0) {
+		feed = page->feed;
+		if (page == feed->current_page) {
+			feed->current_page = NULL;
+		}
+		g_free(page);
+		if (--feed->n_pages == 0) {
+			free_feed(feed);
+		}
+	}
+}
+
+static void free_feed(Feed* feed) {
+	g_hash_table_remove(feeds, feed);
+	mauku_intern_release(feed->publisher);
+	mauku_intern_release(feed->uri);
+	g_free(feed);
+}
+
+static guint feed_hash(gconstpointer key) {
+	const Feed* feed;
+
+	feed = (const Feed*)key;
+
+	return g_direct_hash(feed->uri) * 31 + g_direct_hash(feed->publisher);
+}
+
+static gboolean feed_equal(gconstpointer a, gconstpointer b) {
+
+	return ((const Feed*)a)->uri == ((const Feed*)b)->uri && ((const Feed*)a)->publisher == ((const Feed*)b)->publisher;
+}
+
+static gchar* copy_string(gchar** destination, const gchar* string, gsize length) {
+	gchar* copy = NULL;
+
+	if (string) {
+		copy = *destination;
+		memcpy(copy, string, length);
+		*destination += length;
+	}
+
+	return copy;
+}
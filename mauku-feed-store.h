@@ -0,0 +1,81 @@
+/* Mauku 2.0 (c) Henrik Hedberg <hhedberg@innologies.fi> 
+   You are NOT allowed to modify or redistribute the source code. */
+
+#ifndef __MAUKU_FEED_STORE_H__
+#define __MAUKU_FEED_STORE_H__
+
+#include <gtk/gtk.h>
+#include <microfeed-subscriber/microfeedsubscriber.h>
+
+typedef enum {
+	MAUKU_ITEM_SPAN_URL,
+	MAUKU_ITEM_SPAN_MENTION,
+	MAUKU_ITEM_SPAN_TAG
+} MaukuItemSpanType;
+
+typedef struct {
+	MaukuItemSpanType type;
+	guint start;
+	guint end;
+} MaukuItemSpan;
+
+typedef enum {
+	MAUKU_FEED_RECORD_CHANGED_STATUS = 1 << 0,
+	MAUKU_FEED_RECORD_CHANGED_AVATAR = 1 << 1,
+	MAUKU_FEED_RECORD_CHANGED_TEXT = 1 << 2,
+	MAUKU_FEED_RECORD_CHANGED_COMMENTS = 1 << 3
+} MaukuFeedRecordChanges;
+
+typedef struct _MaukuFeedPage MaukuFeedPage;
+
+/* One record per (publisher, uri, uid), shared by every view and widget that shows the item.
+   The fields are read-only; use the functions below to change them. The const strings are
+   interned (see mauku-intern.h) and can be compared by pointer. The record itself, its uid,
+   text, referred uid and spans are allocated in one block from a page of its feed; if the text
+   is edited later, the new text and spans are allocated in a separate block. */
+typedef struct _MaukuFeedRecord {
+	time_t timestamp;
+	guint ref_count;
+	guint comments;
+	guint n_spans;
+	guint marked : 1;
+	guint unread : 1;
+	guint16 height;
+	guint16 height_width;
+	const gchar* publisher;
+	const gchar* uri;
+	const gchar* uid;
+	const gchar* text;
+	const gchar* sender;
+	const MaukuItemSpan* spans;
+	const gchar* publisher_part;
+	const gchar* sender_uri;
+	const gchar* comments_uri;
+	const gchar* referred_uid;
+	const gchar* referred_uri;
+	const gchar* link;
+	const gchar* avatar_uid;
+	GdkPixbuf* avatar;
+	GList* listeners;
+	MaukuFeedPage* page;
+	gpointer edited_data;
+} MaukuFeedRecord;
+
+typedef void (*MaukuFeedRecordChangedCallback)(MaukuFeedRecord* record, MaukuFeedRecordChanges changes, gpointer user_data);
+typedef void (*MaukuFeedRecordFunc)(MaukuFeedRecord* record, gpointer user_data);
+
+MaukuFeedRecord* mauku_feed_store_get_record(const gchar* publisher, const gchar* uri, MicrofeedItem* item);
+MaukuFeedRecord* mauku_feed_store_lookup(const gchar* publisher, const gchar* uri, const gchar* uid);
+void mauku_feed_store_set_status(const gchar* publisher, const gchar* uri, const gchar* uid, MicrofeedItemStatus status);
+MaukuFeedRecordChanges mauku_feed_store_update_record(MaukuFeedRecord* record, MicrofeedItem* item);
+void mauku_feed_store_foreach_related(const gchar* publisher, const gchar* uri, MaukuFeedRecordFunc func, gpointer user_data);
+
+MaukuFeedRecord* mauku_feed_record_ref(MaukuFeedRecord* record);
+void mauku_feed_record_unref(MaukuFeedRecord* record);
+void mauku_feed_record_set_status(MaukuFeedRecord* record, gboolean marked, gboolean unread);
+void mauku_feed_record_set_avatar(MaukuFeedRecord* record, GdkPixbuf* avatar);
+void mauku_feed_record_set_height(MaukuFeedRecord* record, guint width, guint height);
+void mauku_feed_record_add_listener(MaukuFeedRecord* record, MaukuFeedRecordChangedCallback callback, gpointer user_data);
+void mauku_feed_record_remove_listener(MaukuFeedRecord* record, MaukuFeedRecordChangedCallback callback, gpointer user_data);
+
+#endif
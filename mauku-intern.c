@@ -0,0 +1,60 @@
+/* Mauku 2.0 (c) Henrik Hedberg <hhedberg@innologies.fi> 
+   You are NOT allowed to modify or redistribute the source code. */
+
+#include "mauku-intern.h"
+#include <string.h>
+
+typedef struct {
+	guint ref_count;
+	gchar string[1];
+} InternedString;
+
+/* Two interned strings are equal exactly when their pointers are. */
+static GHashTable* strings = NULL;
+
+/* Returns the interned copy of the string with a new reference, or NULL if the string is NULL. */
+const gchar* mauku_intern_string(const gchar* string) {
+	InternedString* interned_string = NULL;
+	size_t length;
+	
+	if (string) {
+		if (!strings) {
+			strings = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, g_free);
+		}
+		if ((interned_string = (InternedString*)g_hash_table_lookup(strings, string))) {
+			interned_string->ref_count++;
+		} else {
+			length = strlen(string);
+			interned_string = (InternedString*)g_malloc(sizeof(InternedString) + length);
+			interned_string->ref_count = 1;
+			memcpy(interned_string->string, string, length + 1);
+			g_hash_table_insert(strings, interned_string->string, interned_string);
+		}
+	}
+
+	return (interned_string ? interned_string->string : NULL);
+}
+
+/* Returns the interned copy without taking a reference, or NULL if the string has not been interned. */
+const gchar* mauku_intern_lookup(const gchar* string) {
+	InternedString* interned_string = NULL;
+
+	if (string && strings) {
+		interned_string = (InternedString*)g_hash_table_lookup(strings, string);
+	}
+
+	return (interned_string ? interned_string->string : NULL);
+}
+
+void mauku_intern_release(const gchar* string) {
+	InternedString* interned_string;
+
+	if (string) {
+		interned_string = (InternedString*)g_hash_table_lookup(strings, string);
+		g_return_if_fail(interned_string != NULL && interned_string->string == string);
+
+		if (--interned_string->ref_count == 0) {
+			g_hash_table_remove(strings, string);
+		}
+	}
+}
@@ -0,0 +1,13 @@
+/* Mauku 2.0 (c) Henrik Hedberg <hhedberg@innologies.fi> 
+   You are NOT allowed to modify or redistribute the source code. */
+
+#ifndef __MAUKU_INTERN_H__
+#define __MAUKU_INTERN_H__
+
+#include <glib.h>
+
+const gchar* mauku_intern_string(const gchar* string);
+const gchar* mauku_intern_lookup(const gchar* string);
+void mauku_intern_release(const gchar* string);
+
+#endif
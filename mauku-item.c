@@ -4,6 +4,9 @@
 
 #include "mauku.h"
 #include "mauku-item.h"
+#include "mauku-feed-store.h"
+#include "mauku-upload.h"
+#include "mauku-atlas.h"
 #include <microfeed-common/microfeedprotocol.h>
 #include <string.h>
 
@@ -18,6 +21,9 @@
 #define AVATAR_Y 11
 #define MARKED_ICON_X 0
 #define MARKED_ICON_Y 0
+#define COMPACT_MARGIN 6
+#define COMPACT_UNREAD_WIDTH 4
+#define LAYOUT_BYTES_PER_CHAR 24
 
 G_DEFINE_TYPE(MaukuItem, mauku_item, MAUKU_TYPE_WIDGET);
 
@@ -25,24 +31,14 @@ enum {
 	PROP_0,
 };
 
+enum {
+	SIGNAL_MEMORY_USAGE_CHANGED,
+	SIGNAL_COUNT
+};
+
 struct _MaukuItemPrivate {
-	gchar* publisher;
-	gchar* publisher_part;
-	gchar* uri;
-	gchar* uid;
-	GdkPixbuf* avatar;
-	GdkPixbuf* icon;
-	gchar* text;
-	gchar* sender;
-	gchar* sender_uri;
-	time_t timestamp;
-	guint comments;
-	gchar* comments_uri;
-	gchar* referred_uid;
-	gchar* referred_uri;
-	gboolean marked;
-	gboolean unread;
-	gchar* link;
+	MaukuFeedRecord* record;
+	gboolean compact;
 
 	GdkPixmap* buffer;
 	PangoLayout* layout1;
@@ -52,11 +48,30 @@ struct _MaukuItemPrivate {
 	gint layout3_x;
 	gint layout3_y;
 	gint layout3_height;
+	PangoLayout* layout4;
+	gint layout4_y;
+	gchar* annotation;
 	guint timeout_id;
+	gsize memory_usage;
 };
 
 static guint do_layout(MaukuItem* item, guint width);
 static guint do_timestamp_layout(MaukuItem* item, guint width);
+static guint do_annotation_layout(MaukuItem* item, guint width, guint height);
+static PangoContext* get_pango_context(MaukuItem* item);
+static PangoLayout* create_pango_layout(MaukuItem* item, const gchar* text);
+static GdkPixbuf* render_background(MaukuItem* item, gint width, gint height, GdkColor* color);
+static void draw_compact(MaukuItem* item, GdkGC* gc);
+static PangoLayout* get_compact_layout(MaukuItem* item);
+static gchar* get_compact_markup(MaukuItem* item);
+static guint do_compact_layout(MaukuItem* item, guint width);
+static void free_layouts(MaukuItem* item);
+static void update_memory_usage(MaukuItem* item);
+static void on_record_changed(MaukuFeedRecord* record, MaukuFeedRecordChanges changes, gpointer user_data);
+static void drop_pango_context(MaukuItemClass* item_class);
+static void composite(GdkPixbuf* destination, GdkPixbuf* source, gint x, gint y);
+
+static guint signals[SIGNAL_COUNT];
 
 static void mauku_item_set_property(GObject* object, guint prop_id, const GValue* value, GParamSpec* pspec) {
 	MaukuItem* item;
@@ -86,14 +101,9 @@ static void mauku_item_finalize(GObject* object) {
 	MaukuItem* item;
 	
 	item = MAUKU_ITEM(object);
-	g_free(item->priv->publisher);
-	g_free(item->priv->publisher_part);
-	g_free(item->priv->uri);
-	g_free(item->priv->uid);
-	g_free(item->priv->text);
-	g_free(item->priv->sender);
-	g_free(item->priv->sender_uri);
-	g_free(item->priv->link);
+	mauku_feed_record_remove_listener(item->priv->record, on_record_changed, item);
+	mauku_feed_record_unref(item->priv->record);
+	g_free(item->priv->annotation);
 	
 	G_OBJECT_CLASS (mauku_item_parent_class)->finalize(object);
 }
@@ -102,31 +112,7 @@ static void mauku_item_dispose(GObject* object) {
 	MaukuItem* item;
 	
 	item = MAUKU_ITEM(object);
-	if (item->priv->avatar) {
-		g_object_unref(item->priv->avatar);
-		item->priv->avatar = NULL;
-	}
-	if (item->priv->icon) {
-		g_object_unref(item->priv->icon);
-		item->priv->icon = NULL;
-	}
-
-	if (item->priv->layout1) {
-		g_object_unref(item->priv->layout1);
-		item->priv->layout1 = NULL;
-	}
-	if (item->priv->layout2) {
-		g_object_unref(item->priv->layout2);
-		item->priv->layout2 = NULL;
-	}
-	if (item->priv->layout3) {
-		g_object_unref(item->priv->layout3);
-		item->priv->layout3 = NULL;
-	}
-	if (item->priv->timeout_id) {
-		g_source_remove(item->priv->timeout_id);
-		item->priv->timeout_id = 0;
-	}
+	free_layouts(item);
 	if (item->priv->buffer) {
 		g_object_unref(item->priv->buffer);
 		item->priv->buffer = NULL;
@@ -149,22 +135,33 @@ static void mauku_item_size_request(GtkWidget* widget, GtkRequisition* requisiti
 		requisition->width = 792;
 	}
 
-	requisition->height = do_layout(MAUKU_ITEM(widget), requisition->width);
-	if (item->priv->unread) {
-		min_height = (item_class->background_unread ? gdk_pixbuf_get_height(item_class->background_unread) : 0) +
-	        	     (item_class->background_bottom ? gdk_pixbuf_get_height(item_class->background_bottom) : 0);
+	if (item->priv->compact) {
+		requisition->height = do_compact_layout(item, requisition->width);
 	} else {
-		min_height = (item_class->background_top ? gdk_pixbuf_get_height(item_class->background_top) : 0) +
-	        	     (item_class->background_bottom ? gdk_pixbuf_get_height(item_class->background_bottom) : 0);
-	}
-	if (requisition->height < min_height) {
-		requisition->height = min_height;
+		if (!item->priv->layout1 && item->priv->record->height && item->priv->record->height_width == requisition->width) {
+			requisition->height = item->priv->record->height;
+		} else {
+			requisition->height = do_layout(MAUKU_ITEM(widget), requisition->width);
+			mauku_feed_record_set_height(item->priv->record, requisition->width, requisition->height);
+		}
+		requisition->height += do_annotation_layout(item, requisition->width, requisition->height);
+		if (item->priv->record->unread) {
+			min_height = (item_class->background_unread ? gdk_pixbuf_get_height(item_class->background_unread) : 0) +
+		        	     (item_class->background_bottom ? gdk_pixbuf_get_height(item_class->background_bottom) : 0);
+		} else {
+			min_height = (item_class->background_top ? gdk_pixbuf_get_height(item_class->background_top) : 0) +
+		        	     (item_class->background_bottom ? gdk_pixbuf_get_height(item_class->background_bottom) : 0);
+		}
+		if (requisition->height < min_height) {
+			requisition->height = min_height;
+		}
 	}
 
 	if (item->priv->buffer) {
 		g_object_unref(item->priv->buffer);
 		item->priv->buffer = NULL;
 	}
+	update_memory_usage(item);
 }
 
 static gboolean mauku_item_expose_event(GtkWidget* widget, GdkEventExpose* event) {
@@ -182,6 +179,7 @@ static gboolean mauku_item_expose_event(GtkWidget* widget, GdkEventExpose* event
 	char buffer[1024];
 	PangoLayout* layout;
 	gint padding;
+	GdkPixbuf* background;
 	
 	g_return_val_if_fail(MAUKU_IS_ITEM(widget), FALSE);
 	g_return_val_if_fail(event != NULL, FALSE);
@@ -191,53 +189,34 @@ static gboolean mauku_item_expose_event(GtkWidget* widget, GdkEventExpose* event
 		item_class = MAUKU_ITEM_GET_CLASS(item);
 		gc = gdk_gc_new(widget->window);
 
-		if (!item->priv->buffer) {
+		if (!item->priv->buffer && item->priv->compact) {
+			item->priv->buffer = gdk_pixmap_new(widget->window, widget->requisition.width, widget->requisition.height, -1);
+			draw_compact(item, gc);
+		} else if (!item->priv->buffer) {
 			item->priv->buffer = gdk_pixmap_new(widget->window, widget->requisition.width, widget->requisition.height, -1);
 
-			gtk_paint_flat_box(widget->style, item->priv->buffer, GTK_STATE_NORMAL, GTK_SHADOW_NONE, NULL, widget, "maukuitem", 0, 0, -1, -1);
-			if (item_class->background_middle) {
-				for (y = (item_class->background_top ? gdk_pixbuf_get_height(item_class->background_top) : 0);
-				     y < widget->requisition.height - (item_class->background_bottom ? gdk_pixbuf_get_height(item_class->background_bottom) : 0) - gdk_pixbuf_get_height(item_class->background_middle);
-				     y += gdk_pixbuf_get_height(item_class->background_middle)) {
-				     	if (item->priv->referred_uri && item_class->comment_middle) {
-						gdk_draw_pixbuf(item->priv->buffer, NULL, item_class->comment_middle, 0, 0, 0, y, -1, -1, GDK_RGB_DITHER_NONE, 0, 0);
-					} else if (item_class->background_middle) {
-						gdk_draw_pixbuf(item->priv->buffer, NULL, item_class->background_middle, 0, 0, 0, y, -1, -1, GDK_RGB_DITHER_NONE, 0, 0);
-					}
-				}
-				if (item->priv->referred_uri && item_class->comment_middle) {
-					gdk_draw_pixbuf(item->priv->buffer, NULL, item_class->comment_middle, 0, 0, 0, widget->requisition.height - (item_class->comment_bottom ? gdk_pixbuf_get_height(item_class->background_bottom) : 0) - gdk_pixbuf_get_height(item_class->background_middle), -1, -1, GDK_RGB_DITHER_NONE, 0, 0);
-				} else if (item_class->background_middle) {
-					gdk_draw_pixbuf(item->priv->buffer, NULL, item_class->background_middle, 0, 0, 0, widget->requisition.height - (item_class->background_bottom ? gdk_pixbuf_get_height(item_class->background_bottom) : 0) - gdk_pixbuf_get_height(item_class->background_middle), -1, -1, GDK_RGB_DITHER_NONE, 0, 0);
-				}
-
-			}
-
-			if (item->priv->unread && item->priv->referred_uri && item_class->comment_unread) {
-				gdk_draw_pixbuf(item->priv->buffer, NULL, item_class->comment_unread, 0, 0, 0, 0, -1, -1, GDK_RGB_DITHER_NONE, 0, 0);
-			} else if (item->priv->referred_uri && item_class->comment_unread) {
-				gdk_draw_pixbuf(item->priv->buffer, NULL, item_class->comment_top, 0, 0, 0, 0, -1, -1, GDK_RGB_DITHER_NONE, 0, 0);
-			} else if (item->priv->unread && item_class->background_unread) {
-				gdk_draw_pixbuf(item->priv->buffer, NULL, item_class->background_unread, 0, 0, 0, 0, -1, -1, GDK_RGB_DITHER_NONE, 0, 0);
-			} else if (item_class->background_top) {
-				gdk_draw_pixbuf(item->priv->buffer, NULL, item_class->background_top, 0, 0, 0, 0, -1, -1, GDK_RGB_DITHER_NONE, 0, 0);
+			mauku_upload_begin_frame();
+			if (widget->style->bg_pixmap[GTK_STATE_NORMAL]) {
+				background = render_background(item, widget->requisition.width, widget->requisition.height, NULL);
+				gtk_paint_flat_box(widget->style, item->priv->buffer, GTK_STATE_NORMAL, GTK_SHADOW_NONE, NULL, widget, "maukuitem", 0, 0, -1, -1);
+			} else {
+				background = render_background(item, widget->requisition.width, widget->requisition.height, &widget->style->bg[GTK_STATE_NORMAL]);
 			}
-			if (item->priv->comments && item->priv->referred_uri && item_class->comment_comments) {
-				gdk_draw_pixbuf(item->priv->buffer, NULL, item_class->comment_comments, 0, 0, 0, widget->requisition.height - gdk_pixbuf_get_height(item_class->comment_comments), -1, -1, GDK_RGB_DITHER_NONE, 0, 0);
-			} else if (item->priv->referred_uri && item_class->comment_bottom) {
-				gdk_draw_pixbuf(item->priv->buffer, NULL, item_class->comment_bottom, 0, 0, 0, widget->requisition.height - gdk_pixbuf_get_height(item_class->comment_bottom), -1, -1, GDK_RGB_DITHER_NONE, 0, 0);
-			} else if (item->priv->comments && item_class->background_comments) {
-				gdk_draw_pixbuf(item->priv->buffer, NULL, item_class->background_comments, 0, 0, 0, widget->requisition.height - gdk_pixbuf_get_height(item_class->background_comments), -1, -1, GDK_RGB_DITHER_NONE, 0, 0);
-			} else if (item_class->background_bottom) {
-				gdk_draw_pixbuf(item->priv->buffer, NULL, item_class->background_bottom, 0, 0, 0, widget->requisition.height - gdk_pixbuf_get_height(item_class->background_bottom), -1, -1, GDK_RGB_DITHER_NONE, 0, 0);
+			mauku_upload_pixbuf(item->priv->buffer, gc, background, 0, 0, 0, 0, -1, -1);
+			g_object_unref(background);
+			if (item->priv->record->avatar && !mauku_atlas_draw_pixbuf(item->priv->buffer, gc, item->priv->record->avatar, AVATAR_X, AVATAR_Y)) {
+				mauku_upload_pixbuf(item->priv->buffer, gc, item->priv->record->avatar, 0, 0, AVATAR_X, AVATAR_Y, -1, -1);
 			}
-
-			if (item->priv->avatar) {
-				gdk_draw_pixbuf(item->priv->buffer, NULL, item->priv->avatar, 0, 0, AVATAR_X, AVATAR_Y, -1, -1, GDK_RGB_DITHER_NONE, 0, 0);
+			if (item->priv->record->marked && item_class->marked_icon) {
+				mauku_upload_pixbuf(item->priv->buffer, gc, item_class->marked_icon, 0, 0, MARKED_ICON_X, MARKED_ICON_Y, -1, -1);
 			}
 
-			if (!item->priv->layout1) {
-				do_layout(item, widget->requisition.width);
+			if (!item->priv->layout1 && do_layout(item, widget->requisition.width) != item->priv->record->height) {
+				/* The requisition came from a stale height hint. */
+				mauku_feed_record_set_height(item->priv->record, 0, 0);
+				gtk_widget_queue_resize(widget);
+			} else if (item->priv->annotation && !item->priv->layout4) {
+				do_annotation_layout(item, widget->requisition.width, item->priv->record->height);
 			}
 			color.red = color.green = color.blue = 0x0000;
 			if (item->priv->layout1) {
@@ -260,19 +239,22 @@ static gboolean mauku_item_expose_event(GtkWidget* widget, GdkEventExpose* event
 					gdk_draw_layout_with_colors(item->priv->buffer, gc, x - rectangle.x, MARGIN_TOP - rectangle.y, item->priv->layout1, &color, NULL);
 				}
 				gdk_draw_layout_with_colors(item->priv->buffer, gc, MARGIN_LEFT + item->priv->layout3_x, MARGIN_TOP + item->priv->layout3_y, item->priv->layout3, &color, NULL);
+				if (item->priv->layout4) {
+					gdk_draw_layout_with_colors(item->priv->buffer, gc, MARGIN_LEFT + ICON_AREA_INDENT, MARGIN_TOP + item->priv->layout4_y, item->priv->layout4, &color, NULL);
+				}
 			}
-			if (item->priv->marked && item_class->marked_icon) {
-				gdk_draw_pixbuf(item->priv->buffer, NULL, item_class->marked_icon, 0, 0, MARKED_ICON_X, MARKED_ICON_Y, -1, -1, GDK_RGB_DITHER_NONE, 0, 0);
-			}
-			if (item->priv->comments) {
-				snprintf(buffer, 1024, "<small>%d</small>", item->priv->comments);
-				layout = gtk_widget_create_pango_layout(GTK_WIDGET(item), "");
+			if (item->priv->record->comments) {
+				snprintf(buffer, 1024, "<small>%d</small>", item->priv->record->comments);
+				layout = create_pango_layout(item, NULL);
 				pango_layout_set_markup(layout, buffer, -1);
 				pango_layout_get_pixel_extents(layout, NULL, &rectangle);
 				padding = (32 - rectangle.width) / 2;
 				gdk_draw_layout_with_colors(item->priv->buffer, gc, widget->requisition.width - rectangle.width - padding - MARGIN_LEFT, widget->requisition.height - rectangle.height - MARGIN_BOTTOM + 5, layout, &color, NULL);
+				g_object_unref(layout);
 			}
+			mauku_upload_end_frame(NULL, NULL);
 		}
+		update_memory_usage(item);
 		gdk_draw_drawable(widget->window, gc, item->priv->buffer, 0, 0, 0, 0, -1, -1);
 		g_object_unref(gc);
 	}
@@ -280,6 +262,42 @@ static gboolean mauku_item_expose_event(GtkWidget* widget, GdkEventExpose* event
 	return FALSE;
 }
 
+static void mauku_item_style_set(GtkWidget* widget, GtkStyle* previous_style) {
+	MaukuItem* item;
+	MaukuItemClass* item_class;
+	
+	item = MAUKU_ITEM(widget);
+	item_class = MAUKU_ITEM_GET_CLASS(item);
+
+	/* The first item getting the new style drops the shared context, the rest just lay themselves out again. */
+	if (item_class->pango_context &&
+	    !pango_font_description_equal(pango_context_get_font_description(item_class->pango_context), widget->style->font_desc)) {
+		drop_pango_context(item_class);
+	}
+	if (item->priv->buffer) {
+		g_object_unref(item->priv->buffer);
+		item->priv->buffer = NULL;
+	}
+
+	if (GTK_WIDGET_CLASS(mauku_item_parent_class)->style_set) {
+		GTK_WIDGET_CLASS(mauku_item_parent_class)->style_set(widget, previous_style);
+	}
+}
+
+static void mauku_item_screen_changed(GtkWidget* widget, GdkScreen* previous_screen) {
+	MaukuItemClass* item_class;
+	
+	item_class = MAUKU_ITEM_GET_CLASS(widget);
+	if (item_class->pango_context && previous_screen && previous_screen != gtk_widget_get_screen(widget)) {
+		drop_pango_context(item_class);
+		gtk_widget_queue_resize(widget);
+	}
+
+	if (GTK_WIDGET_CLASS(mauku_item_parent_class)->screen_changed) {
+		GTK_WIDGET_CLASS(mauku_item_parent_class)->screen_changed(widget, previous_screen);
+	}
+}
+
 static void mauku_item_class_init(MaukuItemClass* klass) {
 	GObjectClass* gobject_class = G_OBJECT_CLASS(klass);
 	GtkWidgetClass* gtk_widget_class = GTK_WIDGET_CLASS(klass);
@@ -291,6 +309,8 @@ static void mauku_item_class_init(MaukuItemClass* klass) {
 
 	gtk_widget_class->size_request = mauku_item_size_request;
 	gtk_widget_class->expose_event = mauku_item_expose_event;
+	gtk_widget_class->style_set = mauku_item_style_set;
+	gtk_widget_class->screen_changed = mauku_item_screen_changed;
 
 	klass->background_top = gdk_pixbuf_new_from_file(IMAGE_DIR "/background_top.png", NULL);
 	klass->background_middle = gdk_pixbuf_new_from_file(IMAGE_DIR "/background_middle.png", NULL);
@@ -304,6 +324,10 @@ static void mauku_item_class_init(MaukuItemClass* klass) {
 	klass->comment_comments = gdk_pixbuf_new_from_file(IMAGE_DIR "/comment_comments.png", NULL);
 	klass->marked_icon = gdk_pixbuf_new_from_file(IMAGE_DIR "/marked.png", NULL);
 
+	signals[SIGNAL_MEMORY_USAGE_CHANGED] = g_signal_new("memory-usage-changed", MAUKU_TYPE_ITEM, 0, 0,
+	                                                    NULL, NULL,
+	                                                    g_cclosure_marshal_VOID__VOID, G_TYPE_NONE, 0);
+
 	g_type_class_add_private (gobject_class, sizeof (MaukuItemPrivate));
 }
 
@@ -311,154 +335,389 @@ static void mauku_item_init(MaukuItem* item) {
 	item->priv = G_TYPE_INSTANCE_GET_PRIVATE(item, MAUKU_TYPE_ITEM, MaukuItemPrivate);
 }
 
-GtkWidget* mauku_item_new(const gchar* publisher, const gchar* uri, const gchar* uid, GdkPixbuf* avatar, GdkPixbuf* icon, const gchar* text, const gchar* sender, const gchar* sender_uri, time_t timestamp, guint comments, const gchar* comments_uri, const gchar* referred_uid, const gchar* referred_uri, gboolean marked, gboolean unread, const gchar* link) {
+GtkWidget* mauku_item_new(MaukuFeedRecord* record) {
 	GtkWidget* widget;
-	gchar* s;
 	
 	widget = GTK_WIDGET(g_object_new(MAUKU_TYPE_ITEM, NULL));
-	MAUKU_ITEM(widget)->priv->publisher = g_strdup(publisher);
-	if ((s = strchr(publisher, MICROFEED_PUBLISHER_IDENTIFIER_SEPARATOR_CHAR))) {
-		MAUKU_ITEM(widget)->priv->publisher_part = g_strndup(publisher, s - publisher);
-	} else {
-		MAUKU_ITEM(widget)->priv->publisher_part = g_strdup(publisher);
-	}
-	MAUKU_ITEM(widget)->priv->uri = g_strdup(uri);
-	MAUKU_ITEM(widget)->priv->uid = g_strdup(uid);
-	if (avatar) {
-		MAUKU_ITEM(widget)->priv->avatar = g_object_ref(avatar);
-	}
-	if (icon) {
-		MAUKU_ITEM(widget)->priv->icon = g_object_ref(icon);
-	}
-	MAUKU_ITEM(widget)->priv->text = g_strdup(text);
-	MAUKU_ITEM(widget)->priv->sender = g_strdup(sender);
-	MAUKU_ITEM(widget)->priv->sender_uri = g_strdup(sender_uri);
-	MAUKU_ITEM(widget)->priv->timestamp = timestamp;
-	MAUKU_ITEM(widget)->priv->comments = comments;
-	MAUKU_ITEM(widget)->priv->comments_uri = g_strdup(comments_uri);
-	MAUKU_ITEM(widget)->priv->referred_uid = g_strdup(referred_uid);
-	MAUKU_ITEM(widget)->priv->referred_uri = g_strdup(referred_uri);
-	MAUKU_ITEM(widget)->priv->marked = marked;
-	MAUKU_ITEM(widget)->priv->unread = unread;
-	MAUKU_ITEM(widget)->priv->link = g_strdup(link);
+	MAUKU_ITEM(widget)->priv->record = mauku_feed_record_ref(record);
+	mauku_feed_record_add_listener(record, on_record_changed, widget);
 
 	return widget;
 }
 
 GtkWidget* mauku_item_new_from_item(MaukuItem* item) {
 
-	return mauku_item_new(item->priv->publisher, item->priv->uri, item->priv->uid, item->priv->avatar, item->priv->icon, item->priv->text, item->priv->sender, item->priv->sender_uri, item->priv->timestamp, item->priv->comments, item->priv->comments_uri, item->priv->referred_uid, item->priv->referred_uri, item->priv->marked, item->priv->unread, item->priv->link);
+	return mauku_item_new(item->priv->record);
 }
 
+MaukuFeedRecord* mauku_item_get_record(MaukuItem* item) {
+	g_return_val_if_fail(MAUKU_IS_ITEM(item), NULL);
+
+	return item->priv->record;
+}
 
 time_t mauku_item_get_timestamp(MaukuItem* item) {
 	g_return_val_if_fail(MAUKU_IS_ITEM(item), 0);
 	
-	return item->priv->timestamp;
+	return item->priv->record->timestamp;
 }
 
 const gchar* mauku_item_get_publisher(MaukuItem* item) {
 	
-	return item->priv->publisher;
+	return item->priv->record->publisher;
 }
 
 const gchar* mauku_item_get_uri(MaukuItem* item) {
 
-	return item->priv->uri;
+	return item->priv->record->uri;
 }
 
 const gchar* mauku_item_get_uid(MaukuItem* item) {
 
-	return item->priv->uid;
+	return item->priv->record->uid;
 }
 
 const gchar* mauku_item_get_text(MaukuItem* item) {
 
-	return item->priv->text;
+	return item->priv->record->text;
 }
 
 const gchar* mauku_item_get_sender(MaukuItem* item) {
 
-	return item->priv->sender;
+	return item->priv->record->sender;
 }
 
 const gchar* mauku_item_get_sender_uri(MaukuItem* item) {
 
-	return item->priv->sender_uri;
+	return item->priv->record->sender_uri;
 }
 
 const gchar* mauku_item_get_comments_uri(MaukuItem* item) {
 
-	return item->priv->comments_uri;
+	return item->priv->record->comments_uri;
 }
 
 const gchar* mauku_item_get_referred_uid(MaukuItem* item) {
 
-	return item->priv->referred_uid;
+	return item->priv->record->referred_uid;
 }
 
 const gchar* mauku_item_get_referred_uri(MaukuItem* item) {
 
-	return item->priv->referred_uri;
+	return item->priv->record->referred_uri;
 }
 
 const gchar* mauku_item_get_link(MaukuItem* item) {
 
-	return item->priv->link;
+	return item->priv->record->link;
 }
 
 const gboolean mauku_item_get_marked(MaukuItem* item) {
 
-	return item->priv->marked;
+	return item->priv->record->marked;
 }
 
 const gboolean mauku_item_get_unread(MaukuItem* item) {
 
-	return item->priv->unread;
+	return item->priv->record->unread;
 }
 
-void mauku_item_set_marked(MaukuItem* item, gboolean marked) {
-	if ((item->priv->marked && !marked) || (!item->priv->marked && marked)) {
-		item->priv->marked = (marked ? TRUE : FALSE);
+/* Byte spans of the URLs, @mentions and #tags in the text, in the order they appear. */
+const MaukuItemSpan* mauku_item_get_spans(MaukuItem* item, guint* n_spans_return) {
+	g_return_val_if_fail(MAUKU_IS_ITEM(item), NULL);
+
+	*n_spans_return = item->priv->record->n_spans;
+
+	return item->priv->record->spans;
+}
+
+gboolean mauku_item_get_compact(MaukuItem* item) {
+	g_return_val_if_fail(MAUKU_IS_ITEM(item), FALSE);
+
+	return item->priv->compact;
+}
+
+/* A compact item is one ellipsized line without avatar, background images or timestamp. */
+void mauku_item_set_compact(MaukuItem* item, gboolean compact) {
+	g_return_if_fail(MAUKU_IS_ITEM(item));
+
+	if ((item->priv->compact && !compact) || (!item->priv->compact && compact)) {
+		item->priv->compact = (compact ? TRUE : FALSE);
+		if (compact) {
+			free_layouts(item);
+		}
 		if (item->priv->buffer) {
 			g_object_unref(item->priv->buffer);
 			item->priv->buffer = NULL;
 		}
-		gtk_widget_queue_draw(GTK_WIDGET(item));
-	}		
+		gtk_widget_queue_resize(GTK_WIDGET(item));
+	}
 }
 
-void mauku_item_set_unread(MaukuItem* item, gboolean unread) {
-	if ((item->priv->unread && !unread) || (!item->priv->unread && unread)) {
-		item->priv->unread = (unread ? TRUE : FALSE);
+/* An estimate of what the widget holds besides the record: the layouts of the text and the pixmap buffer.
+   The "memory-usage-changed" signal tells when they have been created or freed. */
+gsize mauku_item_get_memory_usage(MaukuItem* item) {
+	gsize bytes;
+	gint width;
+	gint height;
+
+	g_return_val_if_fail(MAUKU_IS_ITEM(item), 0);
+
+	bytes = sizeof(MaukuItem) + sizeof(MaukuItemPrivate);
+	if (item->priv->buffer) {
+		gdk_drawable_get_size(GDK_DRAWABLE(item->priv->buffer), &width, &height);
+		bytes += width * height * ((gdk_drawable_get_depth(GDK_DRAWABLE(item->priv->buffer)) + 7) / 8);
+	}
+	if (item->priv->layout1 && item->priv->record->text) {
+		bytes += strlen(item->priv->record->text) * LAYOUT_BYTES_PER_CHAR;
+	}
+
+	return bytes;
+}
+
+/* Frees the layouts, the buffer and the timestamp timer of an item nobody can see. They are created
+   again when the item is exposed, and the height hint of the record keeps the size until then. */
+void mauku_item_release_resources(MaukuItem* item) {
+	g_return_if_fail(MAUKU_IS_ITEM(item));
+
+	free_layouts(item);
+	if (item->priv->buffer) {
+		g_object_unref(item->priv->buffer);
+		item->priv->buffer = NULL;
+	}
+	update_memory_usage(item);
+}
+
+/* A line of small text below the timestamp, or none if the annotation is NULL. In the compact mode, it follows
+   the sender on the single line. */
+void mauku_item_set_annotation(MaukuItem* item, const gchar* annotation) {
+	g_return_if_fail(MAUKU_IS_ITEM(item));
+
+	if (g_strcmp0(item->priv->annotation, annotation)) {
+		g_free(item->priv->annotation);
+		item->priv->annotation = g_strdup(annotation);
+		if (item->priv->layout4) {
+			g_object_unref(item->priv->layout4);
+			item->priv->layout4 = NULL;
+		}
 		if (item->priv->buffer) {
 			g_object_unref(item->priv->buffer);
 			item->priv->buffer = NULL;
 		}
-		gtk_widget_queue_draw(GTK_WIDGET(item));
+		/* The height hint of the record does not include the annotation, so it stays valid. */
+		gtk_widget_queue_resize(GTK_WIDGET(item));
 	}
 }
 
-void mauku_item_set_avatar(MaukuItem* item, GdkPixbuf* avatar) {
-	if (item->priv->avatar) {
-		g_object_unref(item->priv->avatar);
-	}
-	item->priv->avatar = g_object_ref(avatar);
+static void on_record_changed(MaukuFeedRecord* record, MaukuFeedRecordChanges changes, gpointer user_data) {
+	MaukuItem* item;
+
+	item = MAUKU_ITEM(user_data);
 	if (item->priv->buffer) {
 		g_object_unref(item->priv->buffer);
 		item->priv->buffer = NULL;
 	}
-	gtk_widget_queue_draw(GTK_WIDGET(item));	
+	if (changes & MAUKU_FEED_RECORD_CHANGED_TEXT) {
+		free_layouts(item);
+		gtk_widget_queue_resize(GTK_WIDGET(item));
+	} else {
+		gtk_widget_queue_draw(GTK_WIDGET(item));
+	}
 }
 
 
+/* Composes the background images on the client side, so that the whole thing can be uploaded
+   at once. If color is NULL, the result has an alpha channel. */
+static GdkPixbuf* render_background(MaukuItem* item, gint width, gint height, GdkColor* color) {
+	MaukuItemClass* item_class;
+	GdkPixbuf* background;
+	gint y;
+
+	item_class = MAUKU_ITEM_GET_CLASS(item);
+	background = gdk_pixbuf_new(GDK_COLORSPACE_RGB, (color ? FALSE : TRUE), 8, width, height);
+	if (color) {
+		gdk_pixbuf_fill(background, ((color->red >> 8) << 24) | ((color->green >> 8) << 16) | ((color->blue >> 8) << 8) | 0xff);
+	} else {
+		gdk_pixbuf_fill(background, 0x00000000);
+	}
+
+	if (item_class->background_middle) {
+		for (y = (item_class->background_top ? gdk_pixbuf_get_height(item_class->background_top) : 0);
+		     y < height - (item_class->background_bottom ? gdk_pixbuf_get_height(item_class->background_bottom) : 0) - gdk_pixbuf_get_height(item_class->background_middle);
+		     y += gdk_pixbuf_get_height(item_class->background_middle)) {
+		     	if (item->priv->record->referred_uri && item_class->comment_middle) {
+				composite(background, item_class->comment_middle, 0, y);
+			} else if (item_class->background_middle) {
+				composite(background, item_class->background_middle, 0, y);
+			}
+		}
+		if (item->priv->record->referred_uri && item_class->comment_middle) {
+			composite(background, item_class->comment_middle, 0, height - (item_class->comment_bottom ? gdk_pixbuf_get_height(item_class->background_bottom) : 0) - gdk_pixbuf_get_height(item_class->background_middle));
+		} else if (item_class->background_middle) {
+			composite(background, item_class->background_middle, 0, height - (item_class->background_bottom ? gdk_pixbuf_get_height(item_class->background_bottom) : 0) - gdk_pixbuf_get_height(item_class->background_middle));
+		}
+
+	}
+
+	if (item->priv->record->unread && item->priv->record->referred_uri && item_class->comment_unread) {
+		composite(background, item_class->comment_unread, 0, 0);
+	} else if (item->priv->record->referred_uri && item_class->comment_unread) {
+		composite(background, item_class->comment_top, 0, 0);
+	} else if (item->priv->record->unread && item_class->background_unread) {
+		composite(background, item_class->background_unread, 0, 0);
+	} else if (item_class->background_top) {
+		composite(background, item_class->background_top, 0, 0);
+	}
+	if (item->priv->record->comments && item->priv->record->referred_uri && item_class->comment_comments) {
+		composite(background, item_class->comment_comments, 0, height - gdk_pixbuf_get_height(item_class->comment_comments));
+	} else if (item->priv->record->referred_uri && item_class->comment_bottom) {
+		composite(background, item_class->comment_bottom, 0, height - gdk_pixbuf_get_height(item_class->comment_bottom));
+	} else if (item->priv->record->comments && item_class->background_comments) {
+		composite(background, item_class->background_comments, 0, height - gdk_pixbuf_get_height(item_class->background_comments));
+	} else if (item_class->background_bottom) {
+		composite(background, item_class->background_bottom, 0, height - gdk_pixbuf_get_height(item_class->background_bottom));
+	}
+
+	return background;
+}
+
+static void draw_compact(MaukuItem* item, GdkGC* gc) {
+	MaukuItemClass* item_class;
+	GtkWidget* widget;
+	PangoLayout* layout;
+	GdkColor color;
+	gchar* markup;
+
+	widget = GTK_WIDGET(item);
+	item_class = MAUKU_ITEM_GET_CLASS(item);
+
+	gtk_paint_flat_box(widget->style, item->priv->buffer, GTK_STATE_NORMAL, GTK_SHADOW_NONE, NULL, widget, "maukuitem", 0, 0, -1, -1);
+	if (item->priv->record->unread) {
+		gdk_draw_rectangle(item->priv->buffer, widget->style->bg_gc[GTK_STATE_SELECTED], TRUE, 0, 0, COMPACT_UNREAD_WIDTH, widget->requisition.height);
+	}
+	gdk_draw_line(item->priv->buffer, widget->style->dark_gc[GTK_STATE_NORMAL], 0, widget->requisition.height - 1, widget->requisition.width, widget->requisition.height - 1);
+
+	markup = get_compact_markup(item);
+	layout = get_compact_layout(item);
+	pango_layout_set_width(layout, (widget->requisition.width - MARGIN_LEFT - MARGIN_RIGHT) * PANGO_SCALE);
+	pango_layout_set_markup(layout, markup, -1);
+	color.red = color.green = color.blue = 0x0000;
+	gdk_draw_layout_with_colors(item->priv->buffer, gc, MARGIN_LEFT, COMPACT_MARGIN, layout, &color, NULL);
+	g_free(markup);
+
+	if (item->priv->record->marked && item_class->marked_icon) {
+		mauku_upload_pixbuf(item->priv->buffer, gc, item_class->marked_icon, 0, 0, MARKED_ICON_X, MARKED_ICON_Y, -1, -1);
+	}
+}
+
+/* All compact items are drawn with the same layout. The row height measured from a sample line is the minimum,
+   so that rows of plain text line up; taller scripts and emoji make their own row taller. */
+static PangoLayout* get_compact_layout(MaukuItem* item) {
+	MaukuItemClass* item_class;
+	PangoRectangle rectangle;
+
+	item_class = MAUKU_ITEM_GET_CLASS(item);
+	if (!item_class->compact_layout) {
+		item_class->compact_layout = pango_layout_new(get_pango_context(item));
+		pango_layout_set_single_paragraph_mode(item_class->compact_layout, TRUE);
+		pango_layout_set_ellipsize(item_class->compact_layout, PANGO_ELLIPSIZE_END);
+		pango_layout_set_markup(item_class->compact_layout, "<b>Mauku</b>  Mauku", -1);
+		pango_layout_get_pixel_extents(item_class->compact_layout, NULL, &rectangle);
+		item_class->compact_height = rectangle.height + 2 * COMPACT_MARGIN;
+	}
+
+	return item_class->compact_layout;
+}
+
+static gchar* get_compact_markup(MaukuItem* item) {
+	gchar* text;
+	gchar* markup;
+
+	text = g_strdup(item->priv->record->text ? item->priv->record->text : "");
+	g_strdelimit(text, "\r\n\t", ' ');
+	if (item->priv->annotation) {
+		markup = g_markup_printf_escaped("<b>%s</b> <small>(%s)</small>  %s", (item->priv->record->sender ? item->priv->record->sender : ""),
+		                                 item->priv->annotation, text);
+	} else {
+		markup = g_markup_printf_escaped("<b>%s</b>  %s", (item->priv->record->sender ? item->priv->record->sender : ""), text);
+	}
+	g_free(text);
+
+	return markup;
+}
+
+static guint do_compact_layout(MaukuItem* item, guint width) {
+	MaukuItemClass* item_class;
+	PangoLayout* layout;
+	PangoRectangle rectangle;
+	gchar* markup;
+
+	item_class = MAUKU_ITEM_GET_CLASS(item);
+	layout = get_compact_layout(item);
+	markup = get_compact_markup(item);
+	pango_layout_set_width(layout, (width - MARGIN_LEFT - MARGIN_RIGHT) * PANGO_SCALE);
+	pango_layout_set_markup(layout, markup, -1);
+	pango_layout_get_pixel_extents(layout, NULL, &rectangle);
+	g_free(markup);
+
+	return MAX(rectangle.height + 2 * COMPACT_MARGIN, item_class->compact_height);
+}
+
+static void free_layouts(MaukuItem* item) {
+	if (item->priv->layout1) {
+		g_object_unref(item->priv->layout1);
+		item->priv->layout1 = NULL;
+	}
+	if (item->priv->layout2) {
+		g_object_unref(item->priv->layout2);
+		item->priv->layout2 = NULL;
+	}
+	if (item->priv->layout3) {
+		g_object_unref(item->priv->layout3);
+		item->priv->layout3 = NULL;
+	}
+	if (item->priv->layout4) {
+		g_object_unref(item->priv->layout4);
+		item->priv->layout4 = NULL;
+	}
+	if (item->priv->timeout_id) {
+		g_source_remove(item->priv->timeout_id);
+		item->priv->timeout_id = 0;
+	}
+}
+
+/* Emits "memory-usage-changed" if the estimate differs from the one last reported. */
+static void update_memory_usage(MaukuItem* item) {
+	gsize bytes;
+
+	if ((bytes = mauku_item_get_memory_usage(item)) != item->priv->memory_usage) {
+		item->priv->memory_usage = bytes;
+		g_signal_emit(item, signals[SIGNAL_MEMORY_USAGE_CHANGED], 0);
+	}
+}
+
+static void composite(GdkPixbuf* destination, GdkPixbuf* source, gint x, gint y) {
+	gint dest_x;
+	gint dest_y;
+	gint dest_width;
+	gint dest_height;
+
+	dest_x = MAX(x, 0);
+	dest_y = MAX(y, 0);
+	dest_width = MIN(x + gdk_pixbuf_get_width(source), gdk_pixbuf_get_width(destination)) - dest_x;
+	dest_height = MIN(y + gdk_pixbuf_get_height(source), gdk_pixbuf_get_height(destination)) - dest_y;
+	if (dest_width > 0 && dest_height > 0) {
+		gdk_pixbuf_composite(source, destination, dest_x, dest_y, dest_width, dest_height, x, y, 1.0, 1.0, GDK_INTERP_NEAREST, 255);
+	}
+}
+
 static guint get_icons_width(MaukuItem* item) {
 	guint width;
 	MaukuItemClass* item_class;
 
 	item_class = MAUKU_ITEM_GET_CLASS(item);
 	width = 0;
-/*	if (item->priv->comments > 0) {
+/*	if (item->priv->record->comments > 0) {
 		width += gdk_pixbuf_get_width(item_class->comments_icon) + ICON_AREA_SPACING;
 	}
 */
@@ -477,7 +736,7 @@ static guint do_layout(MaukuItem* item, guint width) {
 		g_object_unref(item->priv->layout2);
 	}
 
-	item->priv->layout1 = gtk_widget_create_pango_layout(GTK_WIDGET(item), item->priv->text);
+	item->priv->layout1 = create_pango_layout(item, item->priv->record->text);
 	pango_layout_set_width(item->priv->layout1, (width - MARGIN_LEFT - ICON_AREA_INDENT - get_icons_width(item) - MARGIN_RIGHT) * PANGO_SCALE);
 	pango_layout_set_wrap(item->priv->layout1, PANGO_WRAP_WORD_CHAR);
 	pango_layout_set_ellipsize(item->priv->layout1, PANGO_ELLIPSIZE_NONE);
@@ -492,7 +751,7 @@ static guint do_layout(MaukuItem* item, guint width) {
 		height += rectangle.height;
 	}
 	if (layout_line) {
-		item->priv->layout2 = gtk_widget_create_pango_layout(GTK_WIDGET(item), item->priv->text + layout_line->start_index);
+		item->priv->layout2 = create_pango_layout(item, item->priv->record->text + layout_line->start_index);
 		pango_layout_set_width(item->priv->layout2, (width - MARGIN_LEFT - MARGIN_RIGHT) * PANGO_SCALE);
 		pango_layout_set_wrap(item->priv->layout2, PANGO_WRAP_WORD_CHAR);
 		pango_layout_set_ellipsize(item->priv->layout2, PANGO_ELLIPSIZE_NONE);			
@@ -503,11 +762,38 @@ static guint do_layout(MaukuItem* item, guint width) {
 		item->priv->layout1_lines = 0;
 	}
 	item->priv->layout3_height = do_timestamp_layout(item, width);
-	height += item->priv->layout3_height + MARGIN_TOP + MARGIN_BOTTOM;
+	height += item->priv->layout3_height;
+	height += MARGIN_TOP + MARGIN_BOTTOM;
 	
 	return height;
 }
 
+/* Lays out the annotation below the rest of the item, whose full height is given, and returns the height it adds.
+   The annotation is set by the view, so it is not part of the height hint of the shared record. */
+static guint do_annotation_layout(MaukuItem* item, guint width, guint height) {
+	PangoRectangle rectangle;
+	gchar* s;
+	guint retvalue = 0;
+
+	if (item->priv->layout4) {
+		g_object_unref(item->priv->layout4);
+		item->priv->layout4 = NULL;
+	}
+	if (item->priv->annotation) {
+		item->priv->layout4 = create_pango_layout(item, NULL);
+		s = g_markup_printf_escaped("<small>%s</small>", item->priv->annotation);
+		pango_layout_set_markup(item->priv->layout4, s, -1);
+		g_free(s);
+		pango_layout_set_width(item->priv->layout4, (width - MARGIN_LEFT - ICON_AREA_INDENT - MARGIN_RIGHT) * PANGO_SCALE);
+		pango_layout_set_ellipsize(item->priv->layout4, PANGO_ELLIPSIZE_END);
+		pango_layout_get_pixel_extents(item->priv->layout4, NULL, &rectangle);
+		item->priv->layout4_y = height - MARGIN_TOP - MARGIN_BOTTOM;
+		retvalue = rectangle.height;
+	}
+
+	return retvalue;
+}
+
 /* t1 = t1 - t2; */
 static void substract_time(struct tm* t1, struct tm* t2) {
 	t1->tm_sec -= t2->tm_sec;
@@ -546,16 +832,16 @@ static guint create_timestamp_text(MaukuItem* item, gchar** text_return) {
 	guint secs_to_next = 30;
 	
 	string = g_string_new("<small>");
-	g_string_append(string, item->priv->sender);
+	g_string_append(string, item->priv->record->sender);
 	g_string_append(string, " in ");
-	g_string_append(string, item->priv->publisher_part);
+	g_string_append(string, item->priv->record->publisher_part);
 	t = time(NULL);
 	gmtime_r(&t, &now);
-	gmtime_r(&item->priv->timestamp, &tm);
+	gmtime_r(&item->priv->record->timestamp, &tm);
 	substract_time(&now, &tm);
 	if (now.tm_year < 0) {
 		g_string_append(string, " in future");
-		secs_to_next = item->priv->timestamp - t;
+		secs_to_next = item->priv->record->timestamp - t;
 	} else if (now.tm_year > 0) {
 		if (now.tm_mon > 0) {
 			g_string_append_printf(string, " %d %s, %d %s ago", now.tm_year, (now.tm_year == 1 ? "year" : "years"), now.tm_mon, (now.tm_mon == 1 ? "month" : "months"));
@@ -604,6 +890,7 @@ static gboolean on_update_timeout(gpointer data) {
 
 	/* gdk_threads_enter(); */
 	item = MAUKU_ITEM(data);
+	item->priv->timeout_id = 0;
 	if (do_timestamp_layout(item, GTK_WIDGET(item)->allocation.width) != item->priv->layout3_height) {
 		gtk_widget_queue_resize(GTK_WIDGET(item));
 	} else {
@@ -631,7 +918,7 @@ static guint do_timestamp_layout(MaukuItem* item, guint width) {
 	if (item->priv->layout3) {
 		g_object_unref(item->priv->layout3);
 	}
-	context = gtk_widget_get_pango_context(GTK_WIDGET(item));
+	context = get_pango_context(item);
 
 	if (item->priv->timeout_id) {
 		g_source_remove(item->priv->timeout_id);
@@ -682,3 +969,42 @@ static guint do_timestamp_layout(MaukuItem* item, guint width) {
 	
 	return height;
 }
+
+/* All items share one PangoContext (and thus its font and metrics caches) instead of
+   GtkWidget creating one for every widget. It is dropped on style and screen changes. */
+static PangoContext* get_pango_context(MaukuItem* item) {
+	MaukuItemClass* item_class;
+	GtkWidget* widget;
+
+	item_class = MAUKU_ITEM_GET_CLASS(item);
+	if (!item_class->pango_context) {
+		widget = GTK_WIDGET(item);
+		item_class->pango_context = gdk_pango_context_get_for_screen(gtk_widget_get_screen(widget));
+		pango_context_set_font_description(item_class->pango_context, widget->style->font_desc);
+		pango_context_set_base_dir(item_class->pango_context, (gtk_widget_get_default_direction() == GTK_TEXT_DIR_RTL ? PANGO_DIRECTION_RTL : PANGO_DIRECTION_LTR));
+		pango_context_set_language(item_class->pango_context, gtk_get_default_language());
+	}
+	
+	return item_class->pango_context;
+}
+
+static void drop_pango_context(MaukuItemClass* item_class) {
+	if (item_class->compact_layout) {
+		g_object_unref(item_class->compact_layout);
+		item_class->compact_layout = NULL;
+		item_class->compact_height = 0;
+	}
+	g_object_unref(item_class->pango_context);
+	item_class->pango_context = NULL;
+}
+
+static PangoLayout* create_pango_layout(MaukuItem* item, const gchar* text) {
+	PangoLayout* layout;
+	
+	layout = pango_layout_new(get_pango_context(item));
+	if (text) {
+		pango_layout_set_text(layout, text, -1);
+	}
+	
+	return layout;
+}
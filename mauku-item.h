@@ -7,6 +7,7 @@
 
 #include <gtk/gtk.h>
 #include "mauku-widget.h"
+#include "mauku-feed-store.h"
 
 #define MAUKU_TYPE_ITEM (mauku_item_get_type ())
 #define MAUKU_ITEM(obj) (G_TYPE_CHECK_INSTANCE_CAST((obj), MAUKU_TYPE_ITEM, MaukuItem))
@@ -37,10 +38,14 @@ typedef struct _MaukuItemClass
 	GdkPixbuf* comment_unread;
 	GdkPixbuf* comment_comments;	
 	GdkPixbuf* marked_icon;
+	PangoContext* pango_context;
+	PangoLayout* compact_layout;
+	gint compact_height;
 } MaukuItemClass;
 
-GtkWidget* mauku_item_new(const gchar* publisher, const gchar* uri, const gchar* uid, GdkPixbuf* avatar, GdkPixbuf* icon, const gchar* text, const gchar* sender, const gchar* sender_uri, time_t timestamp, guint comments, const gchar* comments_uri, const gchar* referred_uid, const gchar* referred_uri, gboolean marked, gboolean unread, const gchar* link);
+GtkWidget* mauku_item_new(MaukuFeedRecord* record);
 GtkWidget* mauku_item_new_from_item(MaukuItem* item);
+MaukuFeedRecord* mauku_item_get_record(MaukuItem* item);
 const gchar* mauku_item_get_publisher(MaukuItem* item);
 const gchar* mauku_item_get_uri(MaukuItem* item);
 const gchar* mauku_item_get_uid(MaukuItem* item);
@@ -54,8 +59,11 @@ const gchar* mauku_item_get_referred_uri(MaukuItem* item);
 const gchar* mauku_item_get_link(MaukuItem* item);
 const gboolean mauku_item_get_marked(MaukuItem* item);
 const gboolean mauku_item_get_unread(MaukuItem* item);
-void mauku_item_set_marked(MaukuItem* item, gboolean marked);
-void mauku_item_set_unread(MaukuItem* item, gboolean unread);
-void mauku_item_set_avatar(MaukuItem* item, GdkPixbuf* avatar);
+const MaukuItemSpan* mauku_item_get_spans(MaukuItem* item, guint* n_spans_return);
+gboolean mauku_item_get_compact(MaukuItem* item);
+void mauku_item_set_compact(MaukuItem* item, gboolean compact);
+gsize mauku_item_get_memory_usage(MaukuItem* item);
+void mauku_item_release_resources(MaukuItem* item);
+void mauku_item_set_annotation(MaukuItem* item, const gchar* annotation);
 
 #endif
@@ -0,0 +1,188 @@
+/* Mauku 2.0 (c) Henrik Hedberg <hhedberg@innologies.fi> 
+   You are NOT allowed to modify or redistribute the source code. */
+
+#include "mauku.h"
+#include "mauku-prefetch.h"
+#include "mauku-intern.h"
+#include <microfeed-common/microfeedprotocol.h>
+#include <string.h>
+
+#define PREFETCH_COUNT 20
+#define PREFETCH_MAX_ACTIVE 2
+#define PREFETCH_MAX_DONE 30
+
+typedef enum {
+	PREFETCH_PENDING,
+	PREFETCH_ACTIVE,
+	PREFETCH_DONE
+} PrefetchState;
+
+/* Fetched feeds keep references to their records in the feed store, the most recently used
+   PREFETCH_MAX_DONE of them, where views find them with mauku_feed_store_foreach_related(). */
+typedef struct {
+	const gchar* publisher;
+	const gchar* uri;
+	PrefetchState state;
+	GPtrArray* records;
+} Prefetch;
+
+static Prefetch* lookup_prefetch(const gchar* publisher, const gchar* uri);
+static void schedule_start(void);
+static gboolean start_next(gpointer user_data);
+static void subscribed(MicrofeedSubscriber* subscriber, const char* publisher, const char* uri, const char* uid, const char* error_name, const char* error_message, void* user_data);
+static void item_added(MicrofeedSubscriber* subscriber, const char* publisher, const char* uri, MicrofeedItem* item, void* user_data);
+static void republished(MicrofeedSubscriber* subscriber, const char* publisher, const char* uri, const char* uid, const char* error_name, const char* error_message, void* user_data);
+static void finish(Prefetch* prefetch);
+static void free_prefetch(Prefetch* prefetch);
+static guint prefetch_hash(gconstpointer key);
+static gboolean prefetch_equal(gconstpointer a, gconstpointer b);
+
+static MicrofeedSubscriberCallbacks callbacks = {
+	NULL, /* error_occured */
+	NULL, /* feed_update_started */
+	NULL, /* feed_update_ended */
+	NULL, /* feed_republishing_started */
+	NULL, /* feed_republishing_ended */
+	item_added,
+	item_added, /* item_changed */
+	item_added, /* item_republished */
+	NULL, /* item_removed */
+	NULL /* item_status_changed */
+};
+
+static GHashTable* prefetches = NULL;
+static GQueue pending = G_QUEUE_INIT;
+static GQueue done = G_QUEUE_INIT;
+static guint n_active = 0;
+static guint start_id = 0;
+
+/* Fetches the newest items of the feed into the feed store when the main loop is otherwise idle. */
+void mauku_prefetch_request(const gchar* publisher, const gchar* uri) {
+	Prefetch* prefetch;
+
+	if ((prefetch = lookup_prefetch(publisher, uri))) {
+		if (prefetch->state == PREFETCH_DONE) {
+			g_queue_remove(&done, prefetch);
+			g_queue_push_tail(&done, prefetch);
+		}
+	} else {
+		prefetch = g_new0(Prefetch, 1);
+		prefetch->publisher = mauku_intern_string(publisher);
+		prefetch->uri = mauku_intern_string(uri);
+		prefetch->state = PREFETCH_PENDING;
+		prefetch->records = g_ptr_array_new();
+		g_hash_table_insert(prefetches, prefetch, prefetch);
+		g_queue_push_tail(&pending, prefetch);
+		schedule_start();
+	}
+}
+
+/* Forgets a request that has not been started yet. */
+void mauku_prefetch_cancel(const gchar* publisher, const gchar* uri) {
+	Prefetch* prefetch;
+
+	if ((prefetch = lookup_prefetch(publisher, uri)) && prefetch->state == PREFETCH_PENDING) {
+		g_queue_remove(&pending, prefetch);
+		g_hash_table_remove(prefetches, prefetch);
+		free_prefetch(prefetch);
+	}
+}
+
+static Prefetch* lookup_prefetch(const gchar* publisher, const gchar* uri) {
+	Prefetch key;
+	Prefetch* prefetch = NULL;
+
+	if (!prefetches) {
+		prefetches = g_hash_table_new(prefetch_hash, prefetch_equal);
+	}
+	if ((key.publisher = mauku_intern_lookup(publisher)) && (key.uri = mauku_intern_lookup(uri))) {
+		prefetch = (Prefetch*)g_hash_table_lookup(prefetches, &key);
+	}
+
+	return prefetch;
+}
+
+static void schedule_start(void) {
+	if (!start_id && pending.length > 0 && n_active < PREFETCH_MAX_ACTIVE) {
+		start_id = g_idle_add_full(G_PRIORITY_LOW, start_next, NULL, NULL);
+	}
+}
+
+static gboolean start_next(gpointer user_data) {
+	Prefetch* prefetch;
+
+	start_id = 0;
+	if ((prefetch = (Prefetch*)g_queue_pop_head(&pending))) {
+		printf("MaukuPrefetch: %s %s\n", prefetch->publisher, prefetch->uri);
+		prefetch->state = PREFETCH_ACTIVE;
+		n_active++;
+		microfeed_subscriber_subscribe_feed(subscriber, prefetch->publisher, prefetch->uri, &callbacks, prefetch, subscribed, prefetch);
+	}
+	schedule_start();
+
+	return FALSE;
+}
+
+static void subscribed(MicrofeedSubscriber* subscriber, const char* publisher, const char* uri, const char* uid, const char* error_name, const char* error_message, void* user_data) {
+	Prefetch* prefetch;
+
+	prefetch = (Prefetch*)user_data;
+	if (error_name) {
+		finish(prefetch);
+	} else {
+		microfeed_subscriber_republish_items(subscriber, prefetch->publisher, prefetch->uri, NULL, NULL, PREFETCH_COUNT, republished, prefetch);
+	}
+}
+
+static void item_added(MicrofeedSubscriber* subscriber, const char* publisher, const char* uri, MicrofeedItem* item, void* user_data) {
+	Prefetch* prefetch;
+
+	prefetch = (Prefetch*)user_data;
+	if (prefetch->state == PREFETCH_ACTIVE && strcmp(microfeed_item_get_uid(item), MICROFEED_ITEM_UID_FEED_METADATA)) {
+		g_ptr_array_add(prefetch->records, mauku_feed_store_get_record(publisher, uri, item));
+	}
+}
+
+static void republished(MicrofeedSubscriber* subscriber, const char* publisher, const char* uri, const char* uid, const char* error_name, const char* error_message, void* user_data) {
+	finish((Prefetch*)user_data);
+}
+
+static void finish(Prefetch* prefetch) {
+	Prefetch* oldest;
+
+	microfeed_subscriber_unsubscribe_feed(subscriber, prefetch->publisher, prefetch->uri, &callbacks, prefetch, NULL, NULL);
+	prefetch->state = PREFETCH_DONE;
+	n_active--;
+	g_queue_push_tail(&done, prefetch);
+	while (done.length > PREFETCH_MAX_DONE) {
+		oldest = (Prefetch*)g_queue_pop_head(&done);
+		g_hash_table_remove(prefetches, oldest);
+		free_prefetch(oldest);
+	}
+	schedule_start();
+}
+
+static void free_prefetch(Prefetch* prefetch) {
+	guint i;
+
+	for (i = 0; i < prefetch->records->len; i++) {
+		mauku_feed_record_unref((MaukuFeedRecord*)prefetch->records->pdata[i]);
+	}
+	g_ptr_array_free(prefetch->records, TRUE);
+	mauku_intern_release(prefetch->publisher);
+	mauku_intern_release(prefetch->uri);
+	g_free(prefetch);
+}
+
+static guint prefetch_hash(gconstpointer key) {
+	const Prefetch* prefetch;
+
+	prefetch = (const Prefetch*)key;
+
+	return g_direct_hash(prefetch->uri) * 31 + g_direct_hash(prefetch->publisher);
+}
+
+static gboolean prefetch_equal(gconstpointer a, gconstpointer b) {
+
+	return ((const Prefetch*)a)->uri == ((const Prefetch*)b)->uri && ((const Prefetch*)a)->publisher == ((const Prefetch*)b)->publisher;
+}
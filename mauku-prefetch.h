@@ -0,0 +1,13 @@
+/* Mauku 2.0 (c) Henrik Hedberg <hhedberg@innologies.fi> 
+   You are NOT allowed to modify or redistribute the source code. */
+
+#ifndef __MAUKU_PREFETCH_H__
+#define __MAUKU_PREFETCH_H__
+
+#include <glib.h>
+#include "mauku-feed-store.h"
+
+void mauku_prefetch_request(const gchar* publisher, const gchar* uri);
+void mauku_prefetch_cancel(const gchar* publisher, const gchar* uri);
+
+#endif
@@ -40,6 +40,7 @@ static void connect_adjustment(MaukuScrollingBox* scrolling_box, GtkAdjustment*
 static void disconnect_adjustment(MaukuScrollingBox* scrolling_box, GtkAdjustment* adjustment);
 static GdkWindow* create_window(GtkWidget* widget, GdkWindow* parent, gint x, gint y, gint width, gint height);
 static gboolean is_visible(gint widget_start, gint widget_end, gint page_start, gint page_end);
+static void insert_child(MaukuScrollingBox* scrolling_box, GtkWidget* child, GList* next_child_in_list);
 
 static guint signals[SIGNAL_COUNT];
 
@@ -72,23 +73,13 @@ void mauku_scrolling_box_add_before(MaukuScrollingBox* scrolling_box, GtkWidget*
 	g_return_if_fail(existing_child == NULL || existing_child->parent == (GtkWidget*)scrolling_box);
 	
 	if (existing_child) {
-		existing_child_in_list = g_list_find(scrolling_box->children, existing_child);
+		existing_child_in_list = (GList*)g_hash_table_lookup(scrolling_box->child_links, existing_child);
 		g_return_if_fail(existing_child_in_list != NULL);
 
-		scrolling_box->children = g_list_insert_before(scrolling_box->children, existing_child_in_list, child);
+		insert_child(scrolling_box, child, existing_child_in_list);
 	} else {
-		scrolling_box->children = g_list_prepend(scrolling_box->children, child);
+		insert_child(scrolling_box, child, scrolling_box->children);
 	}
-	if (scrolling_box->scrolling_window) {
-		gtk_widget_set_parent_window(child, scrolling_box->scrolling_window);
-	}
-	gtk_widget_set_parent(child, GTK_WIDGET(scrolling_box));
-	
-	if (GTK_WIDGET_VISIBLE(child) && GTK_WIDGET_VISIBLE(scrolling_box)) {
-		gtk_widget_queue_resize(child);
-	}
-
-	g_signal_emit(scrolling_box, signals[SIGNAL_CHILD_ADDED], 0, child);
 }
 
 void mauku_scrolling_box_add_after(MaukuScrollingBox* scrolling_box, GtkWidget* child, GtkWidget* existing_child) {
@@ -101,27 +92,13 @@ void mauku_scrolling_box_add_after(MaukuScrollingBox* scrolling_box, GtkWidget*
 	g_return_if_fail(existing_child == NULL || existing_child->parent == (GtkWidget*)scrolling_box);
 
 	if (existing_child) {
-		existing_child_in_list = g_list_find(scrolling_box->children, existing_child);
+		existing_child_in_list = (GList*)g_hash_table_lookup(scrolling_box->child_links, existing_child);
 		g_return_if_fail(existing_child_in_list != NULL);
 
-		if ((existing_child_in_list = g_list_next(existing_child_in_list))) {
-			scrolling_box->children = g_list_insert_before(scrolling_box->children, existing_child_in_list, child);
-		} else {
-			scrolling_box->children = g_list_append(scrolling_box->children, child);
-		}
+		insert_child(scrolling_box, child, g_list_next(existing_child_in_list));
 	} else {
-		scrolling_box->children = g_list_append(scrolling_box->children, child);
-	}
-	if (scrolling_box->scrolling_window) {
-		gtk_widget_set_parent_window(child, scrolling_box->scrolling_window);
-	}
-	gtk_widget_set_parent(child, GTK_WIDGET(scrolling_box));
-
-	if (GTK_WIDGET_VISIBLE(child) && GTK_WIDGET_VISIBLE(scrolling_box)) {
-		gtk_widget_queue_resize(child);
+		insert_child(scrolling_box, child, NULL);
 	}
-
-	g_signal_emit(scrolling_box, signals[SIGNAL_CHILD_ADDED], 0, child);
 }
 
 static void mauku_scrolling_box_class_init(MaukuScrollingBoxClass* scrolling_box_class) {
@@ -173,6 +150,7 @@ static void mauku_scrolling_box_init(MaukuScrollingBox* scrolling_box) {
 	gtk_widget_set_double_buffered(GTK_WIDGET(scrolling_box), FALSE);
 	gtk_container_set_reallocate_redraws(GTK_CONTAINER(scrolling_box), FALSE);
 	gtk_container_set_resize_mode(GTK_CONTAINER(scrolling_box), GTK_RESIZE_QUEUE);
+	scrolling_box->child_links = g_hash_table_new(g_direct_hash, g_direct_equal);
 }
 
 static void mauku_scrolling_box_destroy(GtkObject* object) {
@@ -203,6 +181,7 @@ static void mauku_scrolling_box_finalize(GObject* object) {
 		disconnect_adjustment(scrolling_box, scrolling_box->vadjustment);
 		scrolling_box->vadjustment = NULL;
 	}
+	g_hash_table_destroy(scrolling_box->child_links);
 
 	G_OBJECT_CLASS(g_type_class_peek_parent(g_type_class_peek(MAUKU_TYPE_SCROLLING_BOX)))->finalize(object);
 }
@@ -282,8 +261,12 @@ static void mauku_scrolling_box_remove(GtkContainer* container, GtkWidget* child
 	
 	was_visible = GTK_WIDGET_VISIBLE(child);
 
-	child_in_list = g_list_find(scrolling_box->children, child);
+	child_in_list = (GList*)g_hash_table_lookup(scrolling_box->child_links, child);
 	g_return_if_fail(child_in_list != NULL);
+	g_hash_table_remove(scrolling_box->child_links, child);
+	if (child_in_list == scrolling_box->last_child) {
+		scrolling_box->last_child = child_in_list->prev;
+	}
 	scrolling_box->children = g_list_delete_link(scrolling_box->children, child_in_list);
 	gtk_widget_unparent(child);
 	gtk_widget_set_parent_window(child, NULL);
@@ -627,3 +610,35 @@ static gboolean is_visible(gint widget_start, gint widget_end, gint page_start,
 	       (widget_end >= page_end && widget_end <= page_end) ||
 	       (widget_start < page_start && widget_end > page_end);
 }
+
+/* Links the child into the list in front of the given link (or last, if NULL) without walking the list. */
+static void insert_child(MaukuScrollingBox* scrolling_box, GtkWidget* child, GList* next_child_in_list) {
+	GList* child_in_list;
+	
+	if (next_child_in_list) {
+		scrolling_box->children = g_list_insert_before(scrolling_box->children, next_child_in_list, child);
+		child_in_list = next_child_in_list->prev;
+	} else {
+		child_in_list = g_list_alloc();
+		child_in_list->data = child;
+		child_in_list->prev = scrolling_box->last_child;
+		if (scrolling_box->last_child) {
+			scrolling_box->last_child->next = child_in_list;
+		} else {
+			scrolling_box->children = child_in_list;
+		}
+		scrolling_box->last_child = child_in_list;
+	}
+	g_hash_table_insert(scrolling_box->child_links, child, child_in_list);
+
+	if (scrolling_box->scrolling_window) {
+		gtk_widget_set_parent_window(child, scrolling_box->scrolling_window);
+	}
+	gtk_widget_set_parent(child, GTK_WIDGET(scrolling_box));
+
+	if (GTK_WIDGET_VISIBLE(child) && GTK_WIDGET_VISIBLE(scrolling_box)) {
+		gtk_widget_queue_resize(child);
+	}
+
+	g_signal_emit(scrolling_box, signals[SIGNAL_CHILD_ADDED], 0, child);
+}
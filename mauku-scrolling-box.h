@@ -21,6 +21,8 @@ struct _MaukuScrollingBox {
 	/*< private >*/
 	gboolean horizontal;
 	GList* children;
+	GList* last_child;
+	GHashTable* child_links;
 	GdkWindow* scrolling_window;
 	GtkAdjustment *hadjustment;
 	GtkAdjustment *vadjustment;
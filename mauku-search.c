@@ -0,0 +1,291 @@
+/* Mauku 2.0 (c) Henrik Hedberg <hhedberg@innologies.fi> 
+   You are NOT allowed to modify or redistribute the source code. */
+
+#include "mauku-search.h"
+#include <string.h>
+
+#define COPY_MIN_LENGTH 16
+#define COPY_MAX_NICK_LENGTH 40
+
+/* An inverted index from the trigrams (three consecutive characters of the case folded text) to the data
+   items that contain them. Each item also keeps its own trigrams sorted, so that a candidate from the
+   shortest posting list can be checked against the other trigrams of a query with a binary search and
+   an item can be removed without its text. An item also remembers its position in each posting list, so
+   that it is removed by moving the last one of the list into its place. Trigrams are hashed to 32 bits; a collision only yields an
+   extra candidate, so the caller should verify the matches against the text. */
+struct _MaukuSearchIndex {
+	GHashTable* postings;
+	GHashTable* trigrams;
+};
+
+typedef struct {
+	guint32 trigram;
+	guint position;
+} Trigram;
+
+static void append_trigrams(GArray* trigrams, const gchar* normalized);
+static gint compare_trigrams(gconstpointer a, gconstpointer b);
+static Trigram* lookup_trigram(GArray* trigrams, guint n_trigrams, guint32 trigram);
+static void free_posting(gpointer data);
+static void free_trigrams(gpointer data);
+static const gchar* skip_forwards(const gchar* text, gboolean* forwarded_return);
+
+MaukuSearchIndex* mauku_search_index_new(void) {
+	MaukuSearchIndex* index;
+
+	index = g_new(MaukuSearchIndex, 1);
+	index->postings = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, free_posting);
+	index->trigrams = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, free_trigrams);
+
+	return index;
+}
+
+void mauku_search_index_free(MaukuSearchIndex* index) {
+	g_hash_table_destroy(index->postings);
+	g_hash_table_destroy(index->trigrams);
+	g_free(index);
+}
+
+/* May be called several times for the same data, once for each text it should be found with. */
+void mauku_search_index_add(MaukuSearchIndex* index, gpointer data, const gchar* text) {
+	gchar* normalized;
+	GArray* new_trigrams;
+	GArray* trigrams;
+	GPtrArray* posting;
+	guint n_trigrams;
+	Trigram trigram;
+	guint i;
+
+	if (text) {
+		normalized = mauku_search_normalize(text);
+		new_trigrams = g_array_new(FALSE, FALSE, sizeof(guint32));
+		append_trigrams(new_trigrams, normalized);
+		g_array_sort(new_trigrams, compare_trigrams);
+		if (!(trigrams = (GArray*)g_hash_table_lookup(index->trigrams, data))) {
+			trigrams = g_array_sized_new(FALSE, FALSE, sizeof(Trigram), new_trigrams->len);
+			g_hash_table_insert(index->trigrams, data, trigrams);
+		}
+		n_trigrams = trigrams->len;
+		for (i = 0; i < new_trigrams->len; i++) {
+			trigram.trigram = g_array_index(new_trigrams, guint32, i);
+			if ((i == 0 || trigram.trigram != g_array_index(new_trigrams, guint32, i - 1)) &&
+			    !lookup_trigram(trigrams, n_trigrams, trigram.trigram)) {
+				if (!(posting = (GPtrArray*)g_hash_table_lookup(index->postings, GUINT_TO_POINTER(trigram.trigram)))) {
+					posting = g_ptr_array_new();
+					g_hash_table_insert(index->postings, GUINT_TO_POINTER(trigram.trigram), posting);
+				}
+				trigram.position = posting->len;
+				g_ptr_array_add(posting, data);
+				g_array_append_val(trigrams, trigram);
+			}
+		}
+		g_array_sort(trigrams, compare_trigrams);
+		g_array_free(new_trigrams, TRUE);
+		g_free(normalized);
+	}
+}
+
+void mauku_search_index_remove(MaukuSearchIndex* index, gpointer data) {
+	GArray* trigrams;
+	GArray* moved_trigrams;
+	GPtrArray* posting;
+	Trigram* trigram;
+	guint i;
+
+	if ((trigrams = (GArray*)g_hash_table_lookup(index->trigrams, data))) {
+		for (i = 0; i < trigrams->len; i++) {
+			trigram = &g_array_index(trigrams, Trigram, i);
+			if ((posting = (GPtrArray*)g_hash_table_lookup(index->postings, GUINT_TO_POINTER(trigram->trigram)))) {
+				g_ptr_array_remove_index_fast(posting, trigram->position);
+				if (trigram->position < posting->len) {
+					/* The last item of the list moved into the position. */
+					moved_trigrams = (GArray*)g_hash_table_lookup(index->trigrams, posting->pdata[trigram->position]);
+					lookup_trigram(moved_trigrams, moved_trigrams->len, trigram->trigram)->position = trigram->position;
+				} else if (posting->len == 0) {
+					g_hash_table_remove(index->postings, GUINT_TO_POINTER(trigram->trigram));
+				}
+			}
+		}
+		g_hash_table_remove(index->trigrams, data);
+	}
+}
+
+/* Returns the data items that contain every trigram of the query, in no particular order, or NULL
+   if the query is too short to have any trigrams. */
+GPtrArray* mauku_search_index_query(MaukuSearchIndex* index, const gchar* query) {
+	GPtrArray* results = NULL;
+	gchar* normalized;
+	GArray* query_trigrams;
+	GPtrArray* posting;
+	GPtrArray* shortest = NULL;
+	GArray* trigrams;
+	gboolean found = TRUE;
+	gboolean matches;
+	guint i;
+	guint j;
+
+	normalized = mauku_search_normalize(query);
+	query_trigrams = g_array_new(FALSE, FALSE, sizeof(guint32));
+	append_trigrams(query_trigrams, normalized);
+	if (query_trigrams->len > 0) {
+		results = g_ptr_array_new();
+		for (i = 0; found && i < query_trigrams->len; i++) {
+			if (!(posting = (GPtrArray*)g_hash_table_lookup(index->postings, GUINT_TO_POINTER(g_array_index(query_trigrams, guint32, i))))) {
+				found = FALSE;
+			} else if (!shortest || posting->len < shortest->len) {
+				shortest = posting;
+			}
+		}
+		for (i = 0; found && i < shortest->len; i++) {
+			trigrams = (GArray*)g_hash_table_lookup(index->trigrams, shortest->pdata[i]);
+			matches = TRUE;
+			for (j = 0; matches && j < query_trigrams->len; j++) {
+				matches = (lookup_trigram(trigrams, trigrams->len, g_array_index(query_trigrams, guint32, j)) != NULL);
+			}
+			if (matches) {
+				g_ptr_array_add(results, shortest->pdata[i]);
+			}
+		}
+	}
+	g_array_free(query_trigrams, TRUE);
+	g_free(normalized);
+
+	return results;
+}
+
+/* The form in which both the indexed texts and the queries are compared. */
+gchar* mauku_search_normalize(const gchar* text) {
+
+	return g_utf8_casefold(text, -1);
+}
+
+/* The case folded text without "RT @sender: " prefixes and links, and with whitespace folded into single
+   spaces, so that the copies of a message on several services compare equal. Returns NULL if too little
+   is left to tell a copy from a coincidence. */
+gchar* mauku_search_normalize_copy(const gchar* text, gboolean* forwarded_return) {
+	gchar* retvalue = NULL;
+	gboolean forwarded = FALSE;
+	const gchar* s;
+	gchar* folded;
+	GString* string;
+
+	if (text) {
+		s = skip_forwards(text, &forwarded);
+		folded = g_utf8_casefold(s, -1);
+		string = g_string_new(NULL);
+		for (s = folded; *s; ) {
+			if (g_ascii_isspace(*s)) {
+				s++;
+			} else if (!strncmp(s, "http://", 7) || !strncmp(s, "https://", 8)) {
+				for (; *s && !g_ascii_isspace(*s); s++) {
+				}
+			} else {
+				if (string->len) {
+					g_string_append_c(string, ' ');
+				}
+				for (; *s && !g_ascii_isspace(*s); s++) {
+					g_string_append_c(string, *s);
+				}
+			}
+		}
+		if (string->len >= COPY_MIN_LENGTH) {
+			retvalue = g_string_free(string, FALSE);
+		} else {
+			g_string_free(string, TRUE);
+		}
+		g_free(folded);
+	}
+	if (forwarded_return) {
+		*forwarded_return = forwarded;
+	}
+
+	return retvalue;
+}
+
+/* Whether the text starts with an "RT @sender: " prefix. */
+gboolean mauku_search_is_forwarded(const gchar* text) {
+	gboolean forwarded = FALSE;
+
+	if (text) {
+		skip_forwards(text, &forwarded);
+	}
+
+	return forwarded;
+}
+
+static const gchar* skip_forwards(const gchar* text, gboolean* forwarded_return) {
+	const gchar* s;
+	gsize n;
+
+	*forwarded_return = FALSE;
+	for (s = text; g_ascii_isspace(*s); s++) {
+	}
+	while (!strncmp(s, "RT @", 4) && (n = strcspn(s + 4, ":\n")) <= COPY_MAX_NICK_LENGTH && s[4 + n] == ':') {
+		*forwarded_return = TRUE;
+		for (s += 4 + n + 1; g_ascii_isspace(*s); s++) {
+		}
+	}
+
+	return s;
+}
+
+static void append_trigrams(GArray* trigrams, const gchar* normalized) {
+	gunichar c0;
+	gunichar c1;
+	gunichar c2;
+	guint32 trigram;
+	const gchar* s;
+
+	if (*normalized && *(s = g_utf8_next_char(normalized))) {
+		c1 = g_utf8_get_char(normalized);
+		c2 = g_utf8_get_char(s);
+		for (s = g_utf8_next_char(s); *s; s = g_utf8_next_char(s)) {
+			c0 = c1;
+			c1 = c2;
+			c2 = g_utf8_get_char(s);
+			trigram = (((guint32)c0 * 1000003U) ^ (guint32)c1) * 1000003U ^ (guint32)c2;
+			g_array_append_val(trigrams, trigram);
+		}
+	}
+}
+
+/* Sorts both the plain trigrams and the Trigram entries, which start with the trigram. */
+static gint compare_trigrams(gconstpointer a, gconstpointer b) {
+	guint32 trigram_a;
+	guint32 trigram_b;
+
+	trigram_a = *(const guint32*)a;
+	trigram_b = *(const guint32*)b;
+
+	return (trigram_a < trigram_b ? -1 : (trigram_a > trigram_b ? 1 : 0));
+}
+
+/* Binary search from the first n_trigrams of the sorted array. */
+static Trigram* lookup_trigram(GArray* trigrams, guint n_trigrams, guint32 trigram) {
+	guint low = 0;
+	guint high;
+	guint middle;
+	Trigram* found = NULL;
+
+	high = n_trigrams;
+	while (!found && low < high) {
+		middle = (low + high) / 2;
+		if (g_array_index(trigrams, Trigram, middle).trigram < trigram) {
+			low = middle + 1;
+		} else if (g_array_index(trigrams, Trigram, middle).trigram > trigram) {
+			high = middle;
+		} else {
+			found = &g_array_index(trigrams, Trigram, middle);
+		}
+	}
+
+	return found;
+}
+
+static void free_posting(gpointer data) {
+	g_ptr_array_free((GPtrArray*)data, TRUE);
+}
+
+static void free_trigrams(gpointer data) {
+	g_array_free((GArray*)data, TRUE);
+}
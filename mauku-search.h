@@ -0,0 +1,20 @@
+/* Mauku 2.0 (c) Henrik Hedberg <hhedberg@innologies.fi> 
+   You are NOT allowed to modify or redistribute the source code. */
+
+#ifndef __MAUKU_SEARCH_H__
+#define __MAUKU_SEARCH_H__
+
+#include <glib.h>
+
+typedef struct _MaukuSearchIndex MaukuSearchIndex;
+
+MaukuSearchIndex* mauku_search_index_new(void);
+void mauku_search_index_free(MaukuSearchIndex* index);
+void mauku_search_index_add(MaukuSearchIndex* index, gpointer data, const gchar* text);
+void mauku_search_index_remove(MaukuSearchIndex* index, gpointer data);
+GPtrArray* mauku_search_index_query(MaukuSearchIndex* index, const gchar* query);
+gchar* mauku_search_normalize(const gchar* text);
+gchar* mauku_search_normalize_copy(const gchar* text, gboolean* forwarded_return);
+gboolean mauku_search_is_forwarded(const gchar* text);
+
+#endif
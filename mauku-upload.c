@@ -0,0 +1,189 @@
+/* Mauku 2.0 (c) Henrik Hedberg <hhedberg@innologies.fi> 
+   You are NOT allowed to modify or redistribute the source code. */
+
+#include "mauku-upload.h"
+#include <string.h>
+
+/* Opaque pixbufs are converted into shared memory images (MIT-SHM) and put to the X server
+   without copying the pixels through the socket. Everything else, or everything if the
+   extension is not available, goes through gdk_draw_pixbuf as before. */
+
+#define SCRATCH_IMAGE_COUNT 4
+#define SCRATCH_IMAGE_WIDTH 800
+#define SCRATCH_IMAGE_HEIGHT 128
+
+static GdkImage* scratch_images[SCRATCH_IMAGE_COUNT];
+static gint scratch_image_index;
+static gint scratch_image_width;
+static GdkVisual* scratch_visual;
+static gboolean shared_memory_unavailable;
+static guint frame_shared_bytes;
+static guint frame_copied_bytes;
+static MaukuUploadCounters counters;
+
+static GdkImage* get_scratch_image(GdkVisual* visual, gint width);
+static void free_scratch_images(void);
+static gboolean is_convertable_visual(GdkVisual* visual);
+static void convert_rows(GdkImage* image, GdkPixbuf* pixbuf, gint src_x, gint src_y, gint width, gint height);
+
+void mauku_upload_pixbuf(GdkDrawable* drawable, GdkGC* gc, GdkPixbuf* pixbuf, gint src_x, gint src_y, gint dest_x, gint dest_y, gint width, gint height) {
+	GdkVisual* visual;
+	GdkImage* image;
+	gint drawable_width;
+	gint drawable_height;
+	gint rows;
+
+	g_return_if_fail(GDK_IS_DRAWABLE(drawable));
+	g_return_if_fail(GDK_IS_PIXBUF(pixbuf));
+
+	if (width < 0) {
+		width = gdk_pixbuf_get_width(pixbuf) - src_x;
+	}
+	if (height < 0) {
+		height = gdk_pixbuf_get_height(pixbuf) - src_y;
+	}
+	gdk_drawable_get_size(drawable, &drawable_width, &drawable_height);
+	if (dest_x < 0) {
+		src_x -= dest_x;
+		width += dest_x;
+		dest_x = 0;
+	}
+	if (dest_y < 0) {
+		src_y -= dest_y;
+		height += dest_y;
+		dest_y = 0;
+	}
+	if (dest_x + width > drawable_width) {
+		width = drawable_width - dest_x;
+	}
+	if (dest_y + height > drawable_height) {
+		height = drawable_height - dest_y;
+	}
+	if (width <= 0 || height <= 0) {
+		return;
+	}
+
+	visual = gdk_drawable_get_visual(drawable);
+	while (height > 0 && gc && !gdk_pixbuf_get_has_alpha(pixbuf) && !shared_memory_unavailable &&
+	       is_convertable_visual(visual) && (image = get_scratch_image(visual, width))) {
+		rows = MIN(height, image->height);
+		convert_rows(image, pixbuf, src_x, src_y, width, rows);
+		gdk_draw_image(drawable, gc, image, 0, 0, dest_x, dest_y, width, rows);
+		frame_shared_bytes += width * rows * image->bpp;
+		src_y += rows;
+		dest_y += rows;
+		height -= rows;
+	}
+	if (height > 0) {
+		gdk_draw_pixbuf(drawable, gc, pixbuf, src_x, src_y, dest_x, dest_y, width, height, GDK_RGB_DITHER_NONE, 0, 0);
+		frame_copied_bytes += width * height * gdk_pixbuf_get_n_channels(pixbuf);
+	}
+}
+
+void mauku_upload_begin_frame(void) {
+	frame_shared_bytes = 0;
+	frame_copied_bytes = 0;
+}
+
+void mauku_upload_end_frame(guint* shared_bytes_return, guint* copied_bytes_return) {
+	counters.frames++;
+	counters.last_shared_bytes = frame_shared_bytes;
+	counters.last_copied_bytes = frame_copied_bytes;
+	counters.total_shared_bytes += frame_shared_bytes;
+	counters.total_copied_bytes += frame_copied_bytes;
+	if (shared_bytes_return) {
+		*shared_bytes_return = frame_shared_bytes;
+	}
+	if (copied_bytes_return) {
+		*copied_bytes_return = frame_copied_bytes;
+	}
+}
+
+const MaukuUploadCounters* mauku_upload_get_counters(void) {
+
+	return &counters;
+}
+
+static GdkImage* get_scratch_image(GdkVisual* visual, gint width) {
+	GdkImage* image;
+
+	if (visual != scratch_visual || width > scratch_image_width) {
+		free_scratch_images();
+		scratch_visual = visual;
+		scratch_image_width = MAX(width, SCRATCH_IMAGE_WIDTH);
+	}
+
+	/* The server reads a shared image asynchronously, so make sure it is done with the
+	   earlier ones before reusing them. That is the same thing GdkRGB does. */
+	if (scratch_image_index == SCRATCH_IMAGE_COUNT) {
+		gdk_flush();
+		scratch_image_index = 0;
+	}
+	if (!(image = scratch_images[scratch_image_index])) {
+		if (!(image = gdk_image_new(GDK_IMAGE_SHARED, visual, scratch_image_width, SCRATCH_IMAGE_HEIGHT))) {
+			shared_memory_unavailable = TRUE;
+		} else if ((image->bits_per_pixel != 16 && image->bits_per_pixel != 32) ||
+		           (image->byte_order == GDK_LSB_FIRST) != (G_BYTE_ORDER == G_LITTLE_ENDIAN)) {
+			g_object_unref(image);
+			image = NULL;
+			shared_memory_unavailable = TRUE;
+		} else {
+			scratch_images[scratch_image_index] = image;
+		}
+	}
+	if (image) {
+		scratch_image_index++;
+	}
+
+	return image;
+}
+
+static void free_scratch_images(void) {
+	gint i;
+
+	gdk_flush();
+	for (i = 0; i < SCRATCH_IMAGE_COUNT; i++) {
+		if (scratch_images[i]) {
+			g_object_unref(scratch_images[i]);
+			scratch_images[i] = NULL;
+		}
+	}
+	scratch_image_index = 0;
+}
+
+static gboolean is_convertable_visual(GdkVisual* visual) {
+
+	return visual && visual->type == GDK_VISUAL_TRUE_COLOR &&
+	       visual->red_prec <= 8 && visual->green_prec <= 8 && visual->blue_prec <= 8;
+}
+
+static void convert_rows(GdkImage* image, GdkPixbuf* pixbuf, gint src_x, gint src_y, gint width, gint height) {
+	GdkVisual* visual;
+	const guchar* source;
+	guint16* destination16;
+	guint32* destination32;
+	gint rowstride;
+	gint n_channels;
+	gint x;
+	gint y;
+	guint32 pixel;
+
+	visual = image->visual;
+	rowstride = gdk_pixbuf_get_rowstride(pixbuf);
+	n_channels = gdk_pixbuf_get_n_channels(pixbuf);
+	for (y = 0; y < height; y++) {
+		source = gdk_pixbuf_get_pixels(pixbuf) + (src_y + y) * rowstride + src_x * n_channels;
+		destination16 = (guint16*)((guchar*)image->mem + y * image->bpl);
+		destination32 = (guint32*)destination16;
+		for (x = 0; x < width; x++, source += n_channels) {
+			pixel = ((source[0] >> (8 - visual->red_prec)) << visual->red_shift) |
+			        ((source[1] >> (8 - visual->green_prec)) << visual->green_shift) |
+			        ((source[2] >> (8 - visual->blue_prec)) << visual->blue_shift);
+			if (image->bits_per_pixel == 16) {
+				destination16[x] = pixel;
+			} else {
+				destination32[x] = pixel;
+			}
+		}
+	}
+}
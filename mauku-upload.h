@@ -0,0 +1,23 @@
+/* Mauku 2.0 (c) Henrik Hedberg <hhedberg@innologies.fi> 
+   You are NOT allowed to modify or redistribute the source code. */
+
+#ifndef __MAUKU_UPLOAD_H__
+#define __MAUKU_UPLOAD_H__
+
+#include <gtk/gtk.h>
+
+/* Bytes put to the X server by the drawing frames, through shared memory or copied through the socket. */
+typedef struct {
+	guint frames;
+	guint last_shared_bytes;
+	guint last_copied_bytes;
+	guint64 total_shared_bytes;
+	guint64 total_copied_bytes;
+} MaukuUploadCounters;
+
+void mauku_upload_pixbuf(GdkDrawable* drawable, GdkGC* gc, GdkPixbuf* pixbuf, gint src_x, gint src_y, gint dest_x, gint dest_y, gint width, gint height);
+void mauku_upload_begin_frame(void);
+void mauku_upload_end_frame(guint* shared_bytes_return, guint* copied_bytes_return);
+const MaukuUploadCounters* mauku_upload_get_counters(void);
+
+#endif
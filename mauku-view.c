@@ -5,6 +5,11 @@
 #include "mauku.h"
 #include "mauku-view.h"
 #include "mauku-item.h"
+#include "mauku-feed-store.h"
+#include "mauku-intern.h"
+#include "mauku-cache.h"
+#include "mauku-search.h"
+#include "mauku-prefetch.h"
 #include "mauku-write.h"
 #include "mauku-scrolling-box.h"
 #include <microfeed-common/microfeedmisc.h>
@@ -12,26 +17,123 @@
 #include <hildon/hildon.h>
 #include <string.h>
 
+#define REPUBLISH_COUNT 50
+#define ESTIMATED_ITEM_HEIGHT 70
+#define BACKFILL_MIN_BATCH 5
+#define BACKFILL_MAX_BATCH 20
+#define BACKFILL_BATCH_MILLISECONDS 40
+#define CACHE_SAVE_DELAY 10
+#define INGEST_BUDGET_MILLISECONDS 6
+#define PREFETCH_DELAY 500
+#define MAX_PARKED_VIEWS 3
+#define MERGE_DELAY 300
+#define MERGE_WALK_LIMIT 16
+#define RETENTION_DELAY 5
+#define RETENTION_AGE_INTERVAL 300
+#define COPY_WINDOW (6 * 60 * 60)
+#define HIDDEN_QUEUE_MAX_ITEMS 500
+
+/* The newest screenful of items is requested first, and the rest of the REPUBLISH_COUNT items
+   follow in idle-time batches that continue from the oldest item received so far. */
 typedef struct {
 	MaukuView* view;
-	gchar* publisher;
-	gchar* uri;
+	const gchar* publisher;
+	const gchar* uri;
+	guint pending_callbacks;
+	gboolean removed;
+	guint backfill_id;
+	guint requested;
+	guint received;
+	guint batch_size;
+	guint batch_received;
+	GTimeVal batch_started;
+	gchar* oldest_uid;
+	time_t oldest_timestamp;
+	gboolean republishing;
+	GPtrArray* batch;
 } Subscription;
 
+/* A view is an ordered projection over the shared feed store: one entry per record shown. */
+typedef struct {
+	MaukuFeedRecord* record;
+	MaukuItem* item;
+	GSequenceIter* iter;
+	guint flags;
+	guint fingerprint;
+	gchar* normalized;
+	GPtrArray* copies;
+	gsize bytes;
+} Entry;
+
+/* Replies to the same item shown as one row: the newest reply as an entry, and the others only as records
+   until the row is tapped. Keyed by the publisher and the referred uid, which are the first members so that
+   a probe on the stack can be used for lookups. */
+typedef struct {
+	const gchar* publisher;
+	const gchar* referred_uid;
+	Entry* row;
+	GPtrArray* members;
+	gboolean expanded;
+} Conversation;
+
+/* Incoming records wait here until the ingest idle handler creates their widgets. */
+typedef struct {
+	MaukuFeedRecord* record;
+	GTimeVal queued;
+} Pending;
+
 struct _MaukuView {
 	GtkWidget* window;
 	HildonAppMenu* menu;
 	GtkWidget* pannable_area;
 	GtkWidget* container;
 	GList* subscriptions;
+	GHashTable* items;
+	GSequence* order;
+	GHashTable* unread;
 	gint updating;
 	gint republishing;
 	gchar* jump_to_publisher;
 	gchar* jump_to_uri;
 	gchar* jump_to_uid;
+	gboolean compact;
+	GtkWidget* compact_button;
+	guint filter;
+	MaukuSearchIndex* search_index;
+	gchar* search_query;
+	GHashTable* search_results;
+	GHashTable* searchable;
+	GtkWidget* search_entry;
+	guint prefetch_id;
+	GHashTable* prefetching;
+	gboolean cached;
+	guint cache_save_id;
+	GHashTable* cache_changes;
+	GQueue* urgent_queue;
+	GQueue* background_queue;
+	GQueue* deferred_queue;
+	guint ingest_id;
+	MaukuViewIngestCounters ingest_counters;
+	gboolean parked;
+	guint merge_id;
+	GSequenceIter* last_inserted;
+	MaukuViewRetention retention;
+	guint retention_id;
+	gsize memory_usage;
+	gboolean collapse_conversations;
+	gboolean fold_copies;
+	GHashTable* conversations;
+	GHashTable* collapsed;
+	GHashTable* fingerprints;
+	GHashTable* folded;
 };
 
 static gboolean on_delete_event(MaukuView* view);
+static void park_view(MaukuView* view);
+static void unpark_view(MaukuView* view);
+static void subscribe(Subscription* subscription);
+static void on_search_entry_changed(GtkEditable* editable, gpointer user_data);
+static void set_item_compact(GtkWidget* widget, gpointer user_data);
 static void feed_subscribed(MicrofeedSubscriber* subscriber, const char* publisher, const char* uri, const char* uid, const char* error_name, const char* error_message, void* user_data);
 static HildonAppMenu* create_menu();
 static void error_occured(MicrofeedSubscriber* subscriber, const char* publisher, const char* uri, const char* uid, const char* error_name, const char* error_message, void* user_data);
@@ -40,12 +142,78 @@ static void feed_update_ended(MicrofeedSubscriber* subscriber, const char* publi
 static void feed_republishing_started(MicrofeedSubscriber* subscriber, const char* publisher, const char* uri, void* user_data);
 static void feed_republishing_ended(MicrofeedSubscriber* subscriber, const char* publisher, const char* uri, void* user_data);
 static void item_added(MicrofeedSubscriber* subscriber, const char* publisher, const char* uri, MicrofeedItem* item, void* user_data);
+static void item_changed(MicrofeedSubscriber* subscriber, const char* publisher, const char* uri, MicrofeedItem* item, void* user_data);
+static void item_removed(MicrofeedSubscriber* subscriber, const char* publisher, const char* uri, const char* uid, void* user_data);
 static void item_status_changed(MicrofeedSubscriber* subscriber, const char* publisher, const char* uri, const char* uid, MicrofeedItemStatus status, void* user_data);
-static gboolean get_item(MaukuView* view, const gchar* publisher, const gchar* uri, const gchar* uid, time_t timestamp, MaukuItem** item_return);
+static void remove_entry(MaukuView* view, Entry* entry);
+static void remove_collapsed(MaukuView* view, MaukuFeedRecord* record, Conversation* conversation);
+static void remove_folded(MaukuView* view, MaukuFeedRecord* record, Entry* row);
+static MaukuItem* get_item(MaukuView* view, const gchar* publisher, const gchar* uid);
+static Entry* get_entry(MaukuView* view, const gchar* publisher, const gchar* uid);
+static guint entry_hash(gconstpointer key);
+static gboolean entry_equal(gconstpointer a, gconstpointer b);
+static void add_entry(MaukuView* view, MaukuFeedRecord* record);
+static void schedule_cache_save(MaukuView* view, MaukuFeedRecord* record, gboolean removed);
+static gboolean save_cache(gpointer user_data);
+static void add_loaded_record(MaukuFeedRecord* record, MaukuView* view);
+static gint compare_entries(gconstpointer a, gconstpointer b, gpointer user_data);
+static gint compare_records(const MaukuFeedRecord* record_a, const MaukuFeedRecord* record_b);
+static gint compare_batch_records(gconstpointer a, gconstpointer b);
+static GSequenceIter* insert_entry(MaukuView* view, Entry* entry);
+static void merge_batches(MaukuView* view);
+static void sift_down(GPtrArray* batches, guint* positions, guint* heap, guint n_heap, guint i);
+static gboolean merge_batches_timeout(gpointer user_data);
+static void clear_batch(Subscription* subscription);
+static void on_item_destroy(GtkWidget* widget, gpointer user_data);
+static void on_item_memory_usage_changed(MaukuItem* item, gpointer user_data);
 static void set_progress_indicator(MaukuView* view);
 static void on_pannable_area_realize(GtkWidget* widget, gpointer data);
 static void on_is_topmost_notify(gpointer user_data);
 static void mark_all_read(MaukuView* view);
+static void read_record(MaukuFeedRecord* record);
+static void update_flags(MaukuView* view, Entry* entry);
+static gboolean is_filtered_in(MaukuView* view, Entry* entry);
+static void apply_filter(MaukuView* view, Entry* entry);
+static gboolean matches_search(MaukuView* view, MaukuFeedRecord* record);
+static void index_record(MaukuView* view, MaukuFeedRecord* record);
+static void unindex_record(MaukuView* view, MaukuFeedRecord* record);
+static void add_search_result(MaukuView* view, MaukuFeedRecord* record);
+static void republish(Subscription* subscription, guint count);
+static void republished(MicrofeedSubscriber* subscriber, const char* publisher, const char* uri, const char* uid, const char* error_name, const char* error_message, void* user_data);
+static gboolean backfill(gpointer user_data);
+static guint get_first_screen_count(MaukuView* view);
+static void free_subscription(Subscription* subscription);
+static void queue_record(MaukuView* view, MaukuFeedRecord* record);
+static void queue_record_to(MaukuView* view, MaukuFeedRecord* record, GQueue* queue);
+static gboolean ingest(gpointer user_data);
+static void clear_queue(MaukuView* view, GQueue* queue, const gchar* publisher, const gchar* uri);
+static void remove_queued_record(MaukuView* view, GQueue* queue, MaukuFeedRecord* record);
+static gboolean is_in_viewport(MaukuView* view, MaukuFeedRecord* record, gboolean with_margin);
+static void trim_queues(MaukuView* view);
+static guint get_queue_limit(MaukuView* view);
+static gint compare_pending(gconstpointer a, gconstpointer b);
+static void release_deferred(MaukuView* view);
+static glong get_elapsed_milliseconds(GTimeVal* since);
+static void schedule_prefetch(MaukuView* view);
+static gboolean update_prefetch(gpointer user_data);
+static GSequenceIter* get_viewport_begin(MaukuView* view);
+static void cancel_prefetch(gpointer key, gpointer value, gpointer user_data);
+static void schedule_retention(MaukuView* view, guint seconds);
+static void on_window_show(MaukuView* view);
+static Conversation* get_conversation(MaukuView* view, MaukuFeedRecord* record, gboolean create);
+static guint conversation_hash(gconstpointer key);
+static gboolean conversation_equal(gconstpointer a, gconstpointer b);
+static gboolean collapse_record(MaukuView* view, MaukuFeedRecord* record);
+static void expand_conversation(MaukuView* view, Conversation* conversation);
+static void free_conversation(MaukuView* view, Conversation* conversation);
+static void update_annotation(MaukuView* view, Entry* entry);
+static gboolean fold_copy(MaukuView* view, MaukuFeedRecord* record, gchar** normalized_return);
+static void release_copies(MaukuView* view, Entry* entry, gboolean requeue);
+static void on_window_hide(MaukuView* view);
+static gboolean enforce_retention(gpointer user_data);
+static gsize get_entry_memory_usage(Entry* entry);
+static void account_entry(MaukuView* view, Entry* entry);
+static gboolean is_entry_in_viewport(MaukuView* view, Entry* entry);
 
 
 static MicrofeedSubscriberCallbacks callbacks = {
@@ -55,9 +223,9 @@ static MicrofeedSubscriberCallbacks callbacks = {
 	feed_republishing_started,
 	feed_republishing_ended,
 	item_added,
-	item_added,
+	item_changed,
 	item_added, /* item_republished */
-	NULL, /* item_removed */
+	item_removed,
 	item_status_changed,
 };
 
@@ -67,11 +235,26 @@ MaukuView* mauku_view_new(const gchar* title, gboolean permanent) {
 	GtkWidget* menu;
 	GtkWidget* menu_item;
 	GtkWidget* event_box;
+	GtkWidget* box;
 	int i;
 	gchar* s;
 	time_t t;
 	
 	view = microfeed_memory_allocate(MaukuView);
+	view->items = g_hash_table_new_full(entry_hash, entry_equal, NULL, g_free);
+	view->order = g_sequence_new(NULL);
+	view->unread = g_hash_table_new(g_direct_hash, g_direct_equal);
+	view->urgent_queue = g_queue_new();
+	view->background_queue = g_queue_new();
+	view->deferred_queue = g_queue_new();
+	view->search_index = mauku_search_index_new();
+	view->searchable = g_hash_table_new(entry_hash, entry_equal);
+	view->prefetching = g_hash_table_new(g_direct_hash, g_direct_equal);
+	view->conversations = g_hash_table_new(conversation_hash, conversation_equal);
+	view->collapsed = g_hash_table_new(entry_hash, entry_equal);
+	view->fingerprints = g_hash_table_new(g_direct_hash, g_direct_equal);
+	view->folded = g_hash_table_new(entry_hash, entry_equal);
+	view->cache_changes = g_hash_table_new_full(g_direct_hash, g_direct_equal, (GDestroyNotify)mauku_feed_record_unref, NULL);
 	view->window = hildon_stackable_window_new();
 	if (permanent) {
 		g_signal_connect(view->window, "delete-event", G_CALLBACK(gtk_widget_hide_on_delete), NULL);
@@ -79,34 +262,200 @@ MaukuView* mauku_view_new(const gchar* title, gboolean permanent) {
 		g_signal_connect_swapped(view->window, "delete-event", G_CALLBACK(on_delete_event), view);
 	}
 	g_signal_connect_swapped(view->window, "notify::is-topmost", G_CALLBACK(on_is_topmost_notify), view);	
+	g_signal_connect_swapped(view->window, "show", G_CALLBACK(on_window_show), view);
+	g_signal_connect_swapped(view->window, "hide", G_CALLBACK(on_window_hide), view);
 
 	view->menu = create_menu(view);
 	hildon_window_set_app_menu(HILDON_WINDOW(view->window), view->menu);		
 
 	gtk_window_set_title(GTK_WINDOW(view->window), title);
+	box = gtk_vbox_new(FALSE, 0);
+	gtk_container_add(GTK_CONTAINER(view->window), box);
+
+	view->search_entry = hildon_entry_new(HILDON_SIZE_AUTO);
+	hildon_entry_set_placeholder(HILDON_ENTRY(view->search_entry), "Search");
+	gtk_widget_set_no_show_all(view->search_entry, TRUE);
+	g_signal_connect(view->search_entry, "changed", G_CALLBACK(on_search_entry_changed), view);
+	gtk_box_pack_start(GTK_BOX(box), view->search_entry, FALSE, FALSE, 0);
+
 	view->pannable_area = hildon_pannable_area_new();
 	g_object_set(view->pannable_area, "hscrollbar-policy", GTK_POLICY_NEVER, "vovershoot-max", 400, NULL);
-	gtk_container_add(GTK_CONTAINER(view->window), view->pannable_area);
+	gtk_box_pack_start(GTK_BOX(box), view->pannable_area, TRUE, TRUE, 0);
 
 	view->container = mauku_scrolling_box_new_vertical(hildon_pannable_area_get_hadjustment(HILDON_PANNABLE_AREA(view->pannable_area)),
 	                                                   hildon_pannable_area_get_vadjustment(HILDON_PANNABLE_AREA(view->pannable_area)));
 	gtk_container_add(GTK_CONTAINER(view->pannable_area), view->container);
+	g_signal_connect_swapped(hildon_pannable_area_get_vadjustment(HILDON_PANNABLE_AREA(view->pannable_area)), "value-changed", G_CALLBACK(schedule_prefetch), view);
 	
 	return view;
 }
 
+/* Closed secondary views are kept hidden, with their items but without subscriptions, in case they are opened again. */
+static GQueue parked_views = G_QUEUE_INIT;
+
 static gboolean on_delete_event(MaukuView* view) {
+	park_view(view);
+
+	return TRUE;
+}
+
+/* Opens a secondary view of one feed, or shows again a parked view of the same feed. */
+MaukuView* mauku_view_open(const gchar* title, const gchar* publisher, const gchar* uri) {
+	MaukuView* view = NULL;
+	GList* list;
+	Subscription* subscription;
+	const gchar* interned_publisher;
+	const gchar* interned_uri;
+
+	if ((interned_publisher = mauku_intern_lookup(publisher)) && (interned_uri = mauku_intern_lookup(uri))) {
+		for (list = parked_views.head; list; list = list->next) {
+			subscription = (Subscription*)(((MaukuView*)list->data)->subscriptions ? ((MaukuView*)list->data)->subscriptions->data : NULL);
+			if (subscription && subscription->uri == interned_uri && subscription->publisher == interned_publisher) {
+				view = (MaukuView*)list->data;
+				break;
+			}
+		}
+	}
+	if (view) {
+		printf("mauku_view_open: unparking %s %s\n", publisher, uri);
+		unpark_view(view);
+		gtk_window_set_title(GTK_WINDOW(view->window), title);
+	} else {
+		view = mauku_view_new(title, FALSE);
+		mauku_view_add_feed(view, publisher, uri);
+	}
+
+	return view;
+}
+
+static void park_view(MaukuView* view) {
 	GList* list;
 	Subscription* subscription;
 	
 	for (list = view->subscriptions; list; list = list->next) {
 		subscription = (Subscription*)list->data;
 		microfeed_subscriber_unsubscribe_feed(subscriber, subscription->publisher, subscription->uri, &callbacks, subscription, NULL, NULL);
-		g_free(subscription);
+		if (subscription->backfill_id) {
+			g_source_remove(subscription->backfill_id);
+			subscription->backfill_id = 0;
+		}
+		if (subscription->republishing) {
+			subscription->republishing = FALSE;
+			view->republishing--;
+		}
+		clear_batch(subscription);
+	}
+	set_progress_indicator(view);
+	gtk_widget_hide(view->window);
+	view->parked = TRUE;
+	g_queue_push_tail(&parked_views, view);
+	while (parked_views.length > MAX_PARKED_VIEWS) {
+		mauku_view_free((MaukuView*)g_queue_pop_head(&parked_views));
 	}
-	/* TODO: Free also other stuff. */
+}
 
-	return FALSE;
+/* The subscriptions start from the newest items again; the items already shown are only reconciled. */
+static void unpark_view(MaukuView* view) {
+	GList* list;
+	Subscription* subscription;
+
+	g_queue_remove(&parked_views, view);
+	view->parked = FALSE;
+	for (list = view->subscriptions; list; list = list->next) {
+		subscription = (Subscription*)list->data;
+		subscription->received = 0;
+		g_free(subscription->oldest_uid);
+		subscription->oldest_uid = NULL;
+		subscribe(subscription);
+	}
+}
+
+void mauku_view_free(MaukuView* view) {
+	GList* list;
+	Subscription* subscription;
+	GHashTableIter hash_iter;
+	MaukuFeedRecord* record;
+	gchar* folded;
+	Conversation* conversation;
+
+	if (view->parked) {
+		g_queue_remove(&parked_views, view);
+	}
+	for (list = view->subscriptions; list; list = list->next) {
+		subscription = (Subscription*)list->data;
+		if (!view->parked) {
+			microfeed_subscriber_unsubscribe_feed(subscriber, subscription->publisher, subscription->uri, &callbacks, subscription, NULL, NULL);
+		}
+		free_subscription(subscription);
+	}
+	g_list_free(view->subscriptions);
+	view->subscriptions = NULL;
+	if (view->ingest_id) {
+		g_source_remove(view->ingest_id);
+		view->ingest_id = 0;
+	}
+	clear_queue(view, view->urgent_queue, NULL, NULL);
+	clear_queue(view, view->background_queue, NULL, NULL);
+	clear_queue(view, view->deferred_queue, NULL, NULL);
+	if (view->prefetch_id) {
+		g_source_remove(view->prefetch_id);
+		view->prefetch_id = 0;
+	}
+	if (view->merge_id) {
+		g_source_remove(view->merge_id);
+		view->merge_id = 0;
+	}
+	if (view->retention_id) {
+		g_source_remove(view->retention_id);
+		view->retention_id = 0;
+	}
+	g_hash_table_foreach(view->prefetching, cancel_prefetch, NULL);
+	g_hash_table_remove_all(view->prefetching);
+	if (view->cache_save_id) {
+		g_source_remove(view->cache_save_id);
+		save_cache(view);
+	}
+	/* The items are going away with the window, but the cache should keep them. */
+	view->cached = FALSE;
+	g_signal_handlers_disconnect_by_func(hildon_pannable_area_get_vadjustment(HILDON_PANNABLE_AREA(view->pannable_area)), schedule_prefetch, view);
+	g_signal_handlers_disconnect_by_func(view->window, on_window_show, view);
+	g_signal_handlers_disconnect_by_func(view->window, on_window_hide, view);
+	gtk_widget_destroy(view->window);
+
+	g_hash_table_destroy(view->items);
+	g_sequence_free(view->order);
+	g_hash_table_destroy(view->unread);
+	g_hash_table_destroy(view->cache_changes);
+	g_queue_free(view->urgent_queue);
+	g_queue_free(view->background_queue);
+	g_queue_free(view->deferred_queue);
+	mauku_search_index_free(view->search_index);
+	if (view->search_results) {
+		g_hash_table_destroy(view->search_results);
+	}
+	g_hash_table_iter_init(&hash_iter, view->searchable);
+	while (g_hash_table_iter_next(&hash_iter, (gpointer*)&record, (gpointer*)&folded)) {
+		g_free(folded);
+		mauku_feed_record_unref(record);
+	}
+	g_hash_table_destroy(view->searchable);
+	g_free(view->search_query);
+	g_hash_table_destroy(view->prefetching);
+	/* Destroying the rows with the window freed the conversations, except the expanded ones. */
+	g_hash_table_iter_init(&hash_iter, view->conversations);
+	while (g_hash_table_iter_next(&hash_iter, (gpointer*)&conversation, NULL)) {
+		g_ptr_array_free(conversation->members, TRUE);
+		mauku_intern_release(conversation->referred_uid);
+		g_free(conversation);
+	}
+	g_hash_table_destroy(view->conversations);
+	g_hash_table_destroy(view->collapsed);
+	g_hash_table_destroy(view->fingerprints);
+	g_hash_table_destroy(view->folded);
+	g_free(view->jump_to_publisher);
+	g_free(view->jump_to_uri);
+	g_free(view->jump_to_uid);
+	microfeed_memory_free(view);
 }
 
 void mauku_view_show(MaukuView* view) {
@@ -120,39 +469,87 @@ void mauku_view_add_feed(MaukuView* view, const gchar* publisher, const gchar* u
 	
 	subscription = g_new0(Subscription, 1);
 	subscription->view = view;
-	subscription->publisher = g_strdup(publisher);
-	subscription->uri = g_strdup(uri);
+	subscription->publisher = mauku_intern_string(publisher);
+	subscription->uri = mauku_intern_string(uri);
+	subscription->batch = g_ptr_array_new();
 	view->subscriptions = g_list_prepend(view->subscriptions, subscription);
 
-	microfeed_subscriber_subscribe_feed(subscriber, publisher, uri, &callbacks, subscription, feed_subscribed, subscription);
+	/* Show what is already known locally while the publisher republishes. */
+	mauku_feed_store_foreach_related(publisher, uri, (MaukuFeedRecordFunc)add_loaded_record, view);
+	if (view->cached) {
+		mauku_cache_load_feed(publisher, uri, (MaukuCacheRecordFunc)add_loaded_record, view);
+	} else {
+		mauku_cache_load_related(publisher, uri, (MaukuCacheRecordFunc)add_loaded_record, view);
+	}
+
+	subscribe(subscription);
+}
+
+static void subscribe(Subscription* subscription) {
+	subscription->pending_callbacks++;
+	microfeed_subscriber_subscribe_feed(subscriber, subscription->publisher, subscription->uri, &callbacks, subscription, feed_subscribed, subscription);
 }
 
+/* The collapsed replies and folded copies of the feed go first, so that removing the rows of the feed
+   shows only the records of the other feeds on their own. */
 void mauku_view_remove_feed(MaukuView* view, const gchar* publisher, const gchar* uri) {
 	GList* list;
 	Subscription* subscription;
-	GList* child;
-	MaukuItem* item;
+	GPtrArray* removed;
+	GHashTableIter hash_iter;
+	GSequenceIter* iter;
+	MaukuFeedRecord* record;
+	gpointer value;
+	guint i;
 
 	printf("mauku_view_remove_feed: %s %s\n", publisher, uri);
 
-	for (list = view->subscriptions; list; list = list->next) {
-		subscription = (Subscription*)list->data;
-		if (!strcmp(subscription->uri, uri) && !strcmp(subscription->publisher, publisher)) {
-			view->subscriptions = g_list_delete_link(view->subscriptions, list);
-			g_free(subscription->publisher);
-			g_free(subscription->uri);
-			g_free(subscription);
-			break;
+	if ((publisher = mauku_intern_lookup(publisher)) && (uri = mauku_intern_lookup(uri))) {
+		clear_queue(view, view->urgent_queue, publisher, uri);
+		clear_queue(view, view->background_queue, publisher, uri);
+		clear_queue(view, view->deferred_queue, publisher, uri);
+		removed = g_ptr_array_new();
+		g_hash_table_iter_init(&hash_iter, view->collapsed);
+		while (g_hash_table_iter_next(&hash_iter, (gpointer*)&record, &value)) {
+			if (record->uri == uri && record->publisher == publisher) {
+				g_ptr_array_add(removed, record);
+				g_ptr_array_add(removed, value);
+			}
 		}
-	}
-	list = gtk_container_get_children(GTK_CONTAINER(view->container));
-	for (child = list; child; child = child->next) {
-		item = MAUKU_ITEM(child->data);
-		if (!strcmp(mauku_item_get_uri(item), uri) && !strcmp(mauku_item_get_publisher(item), publisher)) {
-			gtk_widget_destroy(GTK_WIDGET(item));
+		for (i = 0; i < removed->len; i += 2) {
+			remove_collapsed(view, (MaukuFeedRecord*)removed->pdata[i], (Conversation*)removed->pdata[i + 1]);
+		}
+		g_ptr_array_set_size(removed, 0);
+		g_hash_table_iter_init(&hash_iter, view->folded);
+		while (g_hash_table_iter_next(&hash_iter, (gpointer*)&record, &value)) {
+			if (record->uri == uri && record->publisher == publisher) {
+				g_ptr_array_add(removed, record);
+				g_ptr_array_add(removed, value);
+			}
+		}
+		for (i = 0; i < removed->len; i += 2) {
+			remove_folded(view, (MaukuFeedRecord*)removed->pdata[i], (Entry*)removed->pdata[i + 1]);
+		}
+		g_ptr_array_set_size(removed, 0);
+		for (iter = g_sequence_get_begin_iter(view->order); !g_sequence_iter_is_end(iter); iter = g_sequence_iter_next(iter)) {
+			record = ((Entry*)g_sequence_get(iter))->record;
+			if (record->uri == uri && record->publisher == publisher) {
+				g_ptr_array_add(removed, g_sequence_get(iter));
+			}
+		}
+		for (i = 0; i < removed->len; i++) {
+			remove_entry(view, (Entry*)removed->pdata[i]);
+		}
+		g_ptr_array_free(removed, TRUE);
+		for (list = view->subscriptions; list; list = list->next) {
+			subscription = (Subscription*)list->data;
+			if (subscription->uri == uri && subscription->publisher == publisher) {
+				view->subscriptions = g_list_delete_link(view->subscriptions, list);
+				free_subscription(subscription);
+				break;
+			}
 		}
 	}
-	g_list_free(list);
 }
 
 static void scroll_to(MicrofeedSubscriber* subscriber, const char* publisher, const char* uri, const char* uid, const char* error_name, const char* error_message, void* user_data) {
@@ -160,7 +557,7 @@ static void scroll_to(MicrofeedSubscriber* subscriber, const char* publisher, co
 	MaukuItem* item;
 	
 	view = (MaukuView*)user_data;
-	if (!error_name && get_item(view, publisher, uri, uid, 0, &item)) {
+	if (!error_name && (item = get_item(view, publisher, uid))) {
 		hildon_pannable_area_scroll_to_child(HILDON_PANNABLE_AREA(view->pannable_area), GTK_WIDGET(item));
 	}
 }
@@ -169,7 +566,7 @@ gboolean mauku_view_scroll_to_item(MaukuView* view, const gchar* publisher, cons
 	gboolean retvalue = TRUE; /* Always TRUE, since we do not really know yet... */
 	MaukuItem* item;
 	
-	if (get_item(view, publisher, uri, uid, 0, &item)) {
+	if ((item = get_item(view, publisher, uid))) {
 		hildon_pannable_area_scroll_to_child(HILDON_PANNABLE_AREA(view->pannable_area), GTK_WIDGET(item));
 		retvalue = TRUE;
 	} else {
@@ -179,6 +576,152 @@ gboolean mauku_view_scroll_to_item(MaukuView* view, const gchar* publisher, cons
 	return retvalue;
 }
 
+static void add_loaded_record(MaukuFeedRecord* record, MaukuView* view) {
+	queue_record(view, record);
+}
+
+/* A cached view starts from the items saved on disk and saves its items again whenever they change. */
+void mauku_view_set_cached(MaukuView* view, gboolean cached) {
+	view->cached = (cached ? TRUE : FALSE);
+}
+
+/* Shows only the items that have all the given predicate bits. The widgets are hidden, not destroyed,
+   so switching back and forth does not create widgets or ask the publisher for anything. The visible
+   list is the scrolling box skipping hidden children, and its heights are recomputed in the single
+   relayout that GTK coalesces from the show and hide calls. */
+void mauku_view_set_filter(MaukuView* view, guint filter) {
+	GSequenceIter* iter;
+
+	if (view->filter != filter) {
+		view->filter = filter;
+		for (iter = g_sequence_get_begin_iter(view->order); !g_sequence_iter_is_end(iter); iter = g_sequence_iter_next(iter)) {
+			apply_filter(view, (Entry*)g_sequence_get(iter));
+		}
+	}
+}
+
+/* Shows only the items whose text or sender contains the query, or all items if the query is empty or NULL.
+   A row is also shown if one of the replies collapsed or the copies folded into it matches. */
+void mauku_view_set_search(MaukuView* view, const gchar* query) {
+	GPtrArray* candidates;
+	GSequenceIter* iter;
+	GHashTableIter hash_iter;
+	MaukuFeedRecord* record;
+	guint i;
+
+	if (view->search_results) {
+		g_hash_table_destroy(view->search_results);
+		view->search_results = NULL;
+	}
+	g_free(view->search_query);
+	view->search_query = NULL;
+	if (query && *query) {
+		view->search_query = mauku_search_normalize(query);
+		view->search_results = g_hash_table_new(entry_hash, entry_equal);
+		if ((candidates = mauku_search_index_query(view->search_index, query))) {
+			for (i = 0; i < candidates->len; i++) {
+				if (matches_search(view, (MaukuFeedRecord*)candidates->pdata[i])) {
+					add_search_result(view, (MaukuFeedRecord*)candidates->pdata[i]);
+				}
+			}
+			g_ptr_array_free(candidates, TRUE);
+		} else {
+			/* Too short for the index. */
+			g_hash_table_iter_init(&hash_iter, view->searchable);
+			while (g_hash_table_iter_next(&hash_iter, (gpointer*)&record, NULL)) {
+				if (matches_search(view, record)) {
+					add_search_result(view, record);
+				}
+			}
+		}
+	}
+	for (iter = g_sequence_get_begin_iter(view->order); !g_sequence_iter_is_end(iter); iter = g_sequence_iter_next(iter)) {
+		apply_filter(view, (Entry*)g_sequence_get(iter));
+	}
+}
+
+/* Applies to the items added from now on. Turning collapsing off expands all rows. */
+void mauku_view_set_collapse_conversations(MaukuView* view, gboolean collapse) {
+	GHashTableIter iter;
+	Conversation* conversation;
+
+	view->collapse_conversations = (collapse ? TRUE : FALSE);
+	if (!collapse) {
+		g_hash_table_iter_init(&iter, view->conversations);
+		while (g_hash_table_iter_next(&iter, NULL, (gpointer*)&conversation)) {
+			expand_conversation(view, conversation);
+		}
+	}
+}
+
+/* Applies to the items added from now on. Turning folding off shows the folded copies on their own. */
+void mauku_view_set_fold_copies(MaukuView* view, gboolean fold) {
+	GSequenceIter* iter;
+	Entry* entry;
+
+	view->fold_copies = (fold ? TRUE : FALSE);
+	if (!fold) {
+		for (iter = g_sequence_get_begin_iter(view->order); !g_sequence_iter_is_end(iter); iter = g_sequence_iter_next(iter)) {
+			entry = (Entry*)g_sequence_get(iter);
+			if (entry->copies) {
+				release_copies(view, entry, TRUE);
+				update_annotation(view, entry);
+			}
+		}
+	}
+}
+
+static void on_search_entry_changed(GtkEditable* editable, gpointer user_data) {
+	MaukuView* view;
+
+	view = (MaukuView*)user_data;
+	mauku_view_set_search(view, gtk_entry_get_text(GTK_ENTRY(editable)));
+}
+
+static void on_search_button_clicked(GtkButton* button, gpointer user_data) {
+	MaukuView* view;
+
+	view = (MaukuView*)user_data;
+	if (GTK_WIDGET_VISIBLE(view->search_entry)) {
+		gtk_widget_hide(view->search_entry);
+		gtk_entry_set_text(GTK_ENTRY(view->search_entry), "");
+	} else {
+		gtk_widget_show(view->search_entry);
+		gtk_widget_grab_focus(view->search_entry);
+	}
+}
+
+static void on_filter_button_toggled(GtkToggleButton* button, gpointer user_data) {
+	MaukuView* view;
+
+	view = (MaukuView*)user_data;
+	if (gtk_toggle_button_get_active(button)) {
+		mauku_view_set_filter(view, GPOINTER_TO_UINT(g_object_get_data(G_OBJECT(button), "mauku-filter")));
+	}
+}
+
+const MaukuViewIngestCounters* mauku_view_get_ingest_counters(MaukuView* view) {
+
+	return &view->ingest_counters;
+}
+
+/* The oldest items are evicted from the tail of the view when it grows over the limits. Marked items
+   and the items in the viewport are always kept, so the view may stay over its limits. */
+void mauku_view_set_retention(MaukuView* view, const MaukuViewRetention* retention) {
+	view->retention = *retention;
+	if (view->retention_id) {
+		g_source_remove(view->retention_id);
+		view->retention_id = 0;
+	}
+	schedule_retention(view, RETENTION_DELAY);
+}
+
+/* A running total, as each entry was measured when it was added or last changed. */
+gsize mauku_view_get_memory_usage(MaukuView* view) {
+
+	return view->memory_usage;
+}
+
 void mauku_view_update(MaukuView* view) {
 	GList* list;
 	Subscription* subscription;
@@ -196,6 +739,23 @@ static void on_update_button_clicked(GtkButton* button, gpointer user_data) {
 	mauku_view_update(view);
 }
 
+void mauku_view_set_compact(MaukuView* view, gboolean compact) {
+	view->compact = (compact ? TRUE : FALSE);
+	gtk_button_set_label(GTK_BUTTON(view->compact_button), (view->compact ? "Full view" : "Compact view"));
+	gtk_container_foreach(GTK_CONTAINER(view->container), set_item_compact, GINT_TO_POINTER(view->compact));
+}
+
+static void set_item_compact(GtkWidget* widget, gpointer user_data) {
+	mauku_item_set_compact(MAUKU_ITEM(widget), GPOINTER_TO_INT(user_data));
+}
+
+static void on_compact_button_clicked(GtkButton* button, gpointer user_data) {
+	MaukuView* view;
+	
+	view = (MaukuView*)user_data;
+	mauku_view_set_compact(view, !view->compact);
+}
+
 static void on_jump_to_top_button_clicked(GtkButton* button, gpointer user_data) {
 	MaukuView* view;
 	
@@ -210,14 +770,23 @@ static HildonAppMenu* create_menu(MaukuView* view) {
 	
 	app_menu = HILDON_APP_MENU(hildon_app_menu_new());
 
-/*	button = gtk_radio_button_new_with_label(NULL, "Show only new messages");
+	button = gtk_radio_button_new_with_label(NULL, "Show all messages");
 	gtk_toggle_button_set_mode(GTK_TOGGLE_BUTTON(button), FALSE);
+	g_object_set_data(G_OBJECT(button), "mauku-filter", GUINT_TO_POINTER(0));
+	g_signal_connect(button, "toggled", G_CALLBACK(on_filter_button_toggled), view);
 	hildon_app_menu_add_filter(app_menu, GTK_BUTTON(button));
 	
-	button = gtk_radio_button_new_with_label_from_widget(GTK_RADIO_BUTTON(button), "Show all messages");
+	button = gtk_radio_button_new_with_label_from_widget(GTK_RADIO_BUTTON(button), "Show only new messages");
 	gtk_toggle_button_set_mode(GTK_TOGGLE_BUTTON(button), FALSE);
+	g_object_set_data(G_OBJECT(button), "mauku-filter", GUINT_TO_POINTER(MAUKU_VIEW_FILTER_UNREAD));
+	g_signal_connect(button, "toggled", G_CALLBACK(on_filter_button_toggled), view);
+	hildon_app_menu_add_filter(app_menu, GTK_BUTTON(button));
+
+	button = gtk_radio_button_new_with_label_from_widget(GTK_RADIO_BUTTON(button), "Show only marked messages");
+	gtk_toggle_button_set_mode(GTK_TOGGLE_BUTTON(button), FALSE);
+	g_object_set_data(G_OBJECT(button), "mauku-filter", GUINT_TO_POINTER(MAUKU_VIEW_FILTER_MARKED));
+	g_signal_connect(button, "toggled", G_CALLBACK(on_filter_button_toggled), view);
 	hildon_app_menu_add_filter(app_menu, GTK_BUTTON(button));
-*/
 
 	button = gtk_button_new_with_label("Update");
 	g_signal_connect_after(button, "clicked", G_CALLBACK(on_update_button_clicked), view);
@@ -227,15 +796,101 @@ static HildonAppMenu* create_menu(MaukuView* view) {
 	g_signal_connect_after(button, "clicked", G_CALLBACK(on_jump_to_top_button_clicked), view);
 	hildon_app_menu_append(app_menu, GTK_BUTTON(button));
 
+	button = gtk_button_new_with_label("Search");
+	g_signal_connect_after(button, "clicked", G_CALLBACK(on_search_button_clicked), view);
+	hildon_app_menu_append(app_menu, GTK_BUTTON(button));
+
+	view->compact_button = gtk_button_new_with_label("Compact view");
+	g_signal_connect_after(view->compact_button, "clicked", G_CALLBACK(on_compact_button_clicked), view);
+	hildon_app_menu_append(app_menu, GTK_BUTTON(view->compact_button));
+
 	gtk_widget_show_all(GTK_WIDGET(app_menu));
 	
 	return app_menu;
 }
 
 static void feed_subscribed(MicrofeedSubscriber* subscriber, const char* publisher, const char* uri, const char* uid, const char* error_name, const char* error_message, void* user_data) {
+	Subscription* subscription;
+
 	printf("MaukuView::feed_subscribed: %s %s %s %s\n", publisher, uri, error_name, error_message);
 
-	microfeed_subscriber_republish_items(subscriber, publisher, uri, NULL, NULL, 50, NULL, NULL);
+	subscription = (Subscription*)user_data;
+	subscription->pending_callbacks--;
+	if (subscription->removed) {
+		free_subscription(subscription);
+	} else if (!subscription->view->parked) {
+		republish(subscription, get_first_screen_count(subscription->view));
+	}
+}
+
+static void republish(Subscription* subscription, guint count) {
+	count = MIN(count, REPUBLISH_COUNT - subscription->received);
+	subscription->requested = count + (subscription->oldest_uid ? 1 : 0);
+	subscription->batch_received = 0;
+	g_get_current_time(&subscription->batch_started);
+	subscription->pending_callbacks++;
+	if (subscription->oldest_uid) {
+		/* The oldest item received so far is republished again, hence one more. */
+		microfeed_subscriber_republish_items(subscriber, subscription->publisher, subscription->uri, subscription->oldest_uid, NULL, count + 1, republished, subscription);
+	} else {
+		microfeed_subscriber_republish_items(subscriber, subscription->publisher, subscription->uri, NULL, NULL, count, republished, subscription);
+	}
+}
+
+/* Sizes the next batch so that it takes about BACKFILL_BATCH_MILLISECONDS at the measured rate. */
+static void republished(MicrofeedSubscriber* subscriber, const char* publisher, const char* uri, const char* uid, const char* error_name, const char* error_message, void* user_data) {
+	Subscription* subscription;
+	glong elapsed;
+
+	subscription = (Subscription*)user_data;
+	subscription->pending_callbacks--;
+	if (subscription->removed) {
+		free_subscription(subscription);
+	} else if (!error_name && !subscription->view->parked && subscription->batch_received >= subscription->requested && subscription->received < REPUBLISH_COUNT) {
+		elapsed = get_elapsed_milliseconds(&subscription->batch_started);
+		subscription->batch_size = CLAMP(subscription->batch_received * BACKFILL_BATCH_MILLISECONDS / MAX(elapsed, 1), BACKFILL_MIN_BATCH, BACKFILL_MAX_BATCH);
+		printf("MaukuView::republished: %s %s %u items in %ld ms, next batch %u\n", publisher, uri, subscription->batch_received, elapsed, subscription->batch_size);
+		subscription->backfill_id = g_idle_add_full(G_PRIORITY_LOW, backfill, subscription, NULL);
+	}
+}
+
+static gboolean backfill(gpointer user_data) {
+	Subscription* subscription;
+
+	subscription = (Subscription*)user_data;
+	subscription->backfill_id = 0;
+	republish(subscription, subscription->batch_size);
+
+	return FALSE;
+}
+
+/* The number of items that fills the viewport, estimated before any item has been laid out. */
+static guint get_first_screen_count(MaukuView* view) {
+	gint height;
+
+	if ((height = view->pannable_area->allocation.height) <= 1) {
+		height = gdk_screen_get_height(gtk_widget_get_screen(view->window));
+	}
+
+	return height / (view->compact ? ESTIMATED_ITEM_HEIGHT / 2 : ESTIMATED_ITEM_HEIGHT) + 1;
+}
+
+/* A subscription with a callback still pending is freed by that callback. */
+static void free_subscription(Subscription* subscription) {
+	if (subscription->backfill_id) {
+		g_source_remove(subscription->backfill_id);
+		subscription->backfill_id = 0;
+	}
+	clear_batch(subscription);
+	if (subscription->pending_callbacks) {
+		subscription->removed = TRUE;
+	} else {
+		g_ptr_array_free(subscription->batch, TRUE);
+		mauku_intern_release(subscription->publisher);
+		mauku_intern_release(subscription->uri);
+		g_free(subscription->oldest_uid);
+		g_free(subscription);
+	}
 }
 
 static gint press_x, press_y;
@@ -303,8 +958,7 @@ static void on_contact_button_clicked(GtkButton* button, gpointer user_data) {
 
 	item = MAUKU_ITEM(user_data);
 	
-	view = mauku_view_new(mauku_item_get_sender(item), FALSE);
-	mauku_view_add_feed(view, mauku_item_get_publisher(item), mauku_item_get_sender_uri(item));
+	view = mauku_view_open(mauku_item_get_sender(item), mauku_item_get_publisher(item), mauku_item_get_sender_uri(item));
 	mauku_view_show(view);
 
 	gtk_widget_destroy(gtk_widget_get_toplevel(GTK_WIDGET(button)));
@@ -316,8 +970,7 @@ static void on_referred_button_clicked(GtkButton* button, gpointer user_data) {
 
 	item = MAUKU_ITEM(user_data);
 	
-	view = mauku_view_new("Comments", FALSE);
-	mauku_view_add_feed(view, mauku_item_get_publisher(item), mauku_item_get_referred_uri(item));
+	view = mauku_view_open("Comments", mauku_item_get_publisher(item), mauku_item_get_referred_uri(item));
 	mauku_view_show(view);
 
 	gtk_widget_destroy(gtk_widget_get_toplevel(GTK_WIDGET(button)));
@@ -329,8 +982,7 @@ static void on_comments_button_clicked(GtkButton* button, gpointer user_data) {
 
 	item = MAUKU_ITEM(user_data);
 	
-	view = mauku_view_new("Comments", FALSE);
-	mauku_view_add_feed(view, mauku_item_get_publisher(item), mauku_item_get_comments_uri(item));
+	view = mauku_view_open("Comments", mauku_item_get_publisher(item), mauku_item_get_comments_uri(item));
 	mauku_view_show(view);
 
 	gtk_widget_destroy(gtk_widget_get_toplevel(GTK_WIDGET(button)));
@@ -369,13 +1021,11 @@ static void on_open_link_button_clicked(GtkButton* button, gpointer user_data) {
 	MaukuItem* item;
 	GtkWidget* dialog;
 	GtkWidget* touch_selector;
-	const gchar* start;
-	const gchar* end;
-	const gchar* temp;
-	GtkWidget* link_button;
+	const MaukuItemSpan* spans;
+	guint n_spans;
+	guint i;
 	gchar* s;
 	const gchar* cs;
-	gint col = 0, row = 0;
 
 	item = MAUKU_ITEM(user_data);
 		
@@ -389,26 +1039,13 @@ static void on_open_link_button_clicked(GtkButton* button, gpointer user_data) {
 		hildon_touch_selector_append_text(HILDON_TOUCH_SELECTOR(touch_selector), cs);
 	}
 	
-	end = mauku_item_get_text(item);
-	while (((start = strstr(end, "http://")) && start[7] && !g_ascii_isspace(start[7])) ||
-	       ((start = strstr(end, "https://")) && start[8] && !g_ascii_isspace(start[8])) ||
-	       ((start = strstr(end, "www.")) && start[4] && !g_ascii_isspace(start[4]))) {
-		if (*start == 'h' && (temp = strstr(end, "www.")) && temp[4] && !g_ascii_isspace(temp[4]) && temp < start) {
-			start = temp;
-		} else if (*start == 'w' && (temp = strstr(end, "http://")) && temp[7] && !g_ascii_isspace(temp[7]) && temp < start) {
-			start = temp;
-		}
-		for (end = start; *end; end++) {
-			if (g_ascii_isspace(*end) || *end == ')') {
-				break;
-			}
-		}
-		while (end > start && *(end - 1) == '.') {
-			end--;
+	spans = mauku_item_get_spans(item, &n_spans);
+	for (i = 0; i < n_spans; i++) {
+		if (spans[i].type == MAUKU_ITEM_SPAN_URL) {
+			s = g_strndup(mauku_item_get_text(item) + spans[i].start, spans[i].end - spans[i].start);
+			hildon_touch_selector_append_text(HILDON_TOUCH_SELECTOR(touch_selector), s);
+			g_free(s);
 		}
-		s = g_strndup(start, end - start);
-		hildon_touch_selector_append_text(HILDON_TOUCH_SELECTOR(touch_selector), s);
-		g_free(s);
 	}
 
 	g_signal_connect(dialog, "response", G_CALLBACK(on_open_link_dialog_response), touch_selector);
@@ -496,12 +1133,18 @@ static gboolean on_button_release_event(GtkWidget* widget, GdkEventButton* event
 	gboolean handled = FALSE;
 	MaukuView* view;
 	gint x, y;
+	Conversation* conversation;
 	
 	view = (MaukuView*)user_data;
 	
 	gtk_widget_translate_coordinates(widget, view->window, event->x, event->y, &x, &y);		
 	if (!gtk_drag_check_threshold(widget, press_x, press_y, x, y)) {
-		show_item_dialog(view, MAUKU_ITEM(widget));
+		if ((conversation = get_conversation(view, mauku_item_get_record(MAUKU_ITEM(widget)), FALSE)) &&
+		    conversation->row && GTK_WIDGET(conversation->row->item) == widget && conversation->members->len > 0) {
+			expand_conversation(view, conversation);
+		} else {
+			show_item_dialog(view, MAUKU_ITEM(widget));
+		}
 		handled = TRUE;
 	}
 		
@@ -541,6 +1184,7 @@ static void feed_republishing_started(MicrofeedSubscriber* subscriber, const cha
 	subscription = (Subscription*)user_data;
 	view = subscription->view;
 	view->republishing++;
+	subscription->republishing = TRUE;
 	set_progress_indicator(view);
 }	
 
@@ -551,32 +1195,33 @@ static void feed_republishing_ended(MicrofeedSubscriber* subscriber, const char*
 	subscription = (Subscription*)user_data;
 	view = subscription->view;
 	view->republishing--;
+	subscription->republishing = FALSE;
 	set_progress_indicator(view);
+	if (view->republishing == 0) {
+		merge_batches(view);
+	} else if (!view->merge_id) {
+		/* Do not let a slow publisher hold back the others for long. */
+		view->merge_id = g_timeout_add(MERGE_DELAY, merge_batches_timeout, view);
+	}
 }	
 
 static void image_stored(MicrofeedSubscriber* subscriber, const char* publisher, const char* url, const char* not_used, const char* error_name, const char* error_message, void* user_data) {
-	MaukuItem* item;
+	MaukuFeedRecord* record;
 	GdkPixbuf* avatar;
 	
-	item = MAUKU_ITEM(user_data);
+	record = (MaukuFeedRecord*)user_data;
 
 	if (!error_name && (avatar = image_cache_get_image(publisher, url))) {
-		mauku_item_set_avatar(item, avatar);
+		mauku_feed_record_set_avatar(record, avatar);
 	}
+	mauku_feed_record_unref(record);
 }
 
 static void item_added(MicrofeedSubscriber* subscriber, const char* publisher, const char* uri, MicrofeedItem* item, void* user_data) {
 	Subscription* subscription;
 	MaukuView* view;
-	MaukuItem* existing_item;
-	const char* s;
-	guint comments = 0;
-	const char* uid;
-	const void* data;
-	size_t length;
-	GdkPixbuf* avatar = NULL;
-	GdkPixbuf* icon = NULL;
-	GtkWidget* widget;
+	MaukuFeedRecord* record;
+	Entry* entry;
 
 	printf("MaukuView::item_added: %s %s %s\n", publisher, uri, microfeed_item_get_uid(item));
 	
@@ -585,104 +1230,1224 @@ static void item_added(MicrofeedSubscriber* subscriber, const char* publisher, c
 
 	if (!strcmp(microfeed_item_get_uid(item), MICROFEED_ITEM_UID_FEED_METADATA)) {
 	
-	} else if (get_item(view, publisher, uri, microfeed_item_get_uid(item), microfeed_item_get_timestamp(item), &existing_item)) {
-	
 	} else {
-		if ((s = microfeed_item_get_property(item, MICROFEED_ITEM_PROPERTY_NAME_COMMENTS_COUNT))) {
-			comments = atoi(s);
+		if (!subscription->oldest_uid || microfeed_item_get_timestamp(item) < subscription->oldest_timestamp) {
+			g_free(subscription->oldest_uid);
+			subscription->oldest_uid = g_strdup(microfeed_item_get_uid(item));
+			subscription->oldest_timestamp = microfeed_item_get_timestamp(item);
 		}
+		subscription->batch_received++;
+		subscription->received++;
+		record = mauku_feed_store_get_record(publisher, uri, item);
+		/* The record may have been loaded from the cache: the publisher knows the current status. */
+		mauku_feed_record_set_status(record, microfeed_item_get_status(item) & MICROFEED_ITEM_STATUS_MARKED,
+		                             microfeed_item_get_status(item) & MICROFEED_ITEM_STATUS_UNREAD);
+		if ((entry = (Entry*)g_hash_table_lookup(view->items, record))) {
+			if (entry->record != record) {
+				/* Seeded from another feed. */
+				mauku_feed_record_set_status(entry->record, record->marked, record->unread);
+			}
+			update_flags(view, entry);
+			mauku_feed_record_unref(record);
+		} else if (subscription->republishing) {
+			g_ptr_array_add(subscription->batch, record);
+		} else {
+			queue_record(view, record);
+		}
+	}
+}
 
-
-		if ((uid = microfeed_item_get_property(item, MICROFEED_ITEM_PROPERTY_NAME_USER_IMAGE))) {
-			avatar = image_cache_get_image(publisher, uid);
+/* Takes over the reference to the record. */
+static void add_entry(MaukuView* view, MaukuFeedRecord* record) {
+	Entry* entry;
+	GSequenceIter* next;
+	GtkWidget* widget;
+	Conversation* conversation;
+	gchar* normalized = NULL;
+
+	if (g_hash_table_lookup(view->items, record) || g_hash_table_lookup(view->collapsed, record) ||
+	    g_hash_table_lookup(view->folded, record)) {
+		mauku_feed_record_unref(record);
+	} else if (!fold_copy(view, record, &normalized) && !collapse_record(view, record)) {
+		widget = mauku_item_new(record);
+		mauku_item_set_compact(MAUKU_ITEM(widget), view->compact);
+		/* Only the filter shows and hides items, not gtk_widget_show_all() of the window. */
+		gtk_widget_set_no_show_all(widget, TRUE);
+		if (record->avatar_uid && !record->avatar) {
+			microfeed_subscriber_store_data(subscriber, record->publisher, record->avatar_uid, image_stored, mauku_feed_record_ref(record));
 		}
-		
-		widget = mauku_item_new(publisher, uri, microfeed_item_get_uid(item), avatar, icon,
-	                        	microfeed_item_get_property(item, MICROFEED_ITEM_PROPERTY_NAME_CONTENT_TEXT),
-	                        	microfeed_item_get_property(item, MICROFEED_ITEM_PROPERTY_NAME_USER_NICK),
-					microfeed_item_get_property(item, MICROFEED_ITEM_PROPERTY_NAME_USER_FEED),
-	                        	microfeed_item_get_timestamp(item),
-	                        	comments,
-					microfeed_item_get_property(item, MICROFEED_ITEM_PROPERTY_NAME_COMMENTS_FEED),
-					microfeed_item_get_property(item, MICROFEED_ITEM_PROPERTY_NAME_REFERRED_ITEM),
-					microfeed_item_get_property(item, MICROFEED_ITEM_PROPERTY_NAME_REFERRED_FEED),
-					microfeed_item_get_status(item) & MICROFEED_ITEM_STATUS_MARKED,
-					microfeed_item_get_status(item) & MICROFEED_ITEM_STATUS_UNREAD,
-					microfeed_item_get_property(item, MICROFEED_ITEM_PROPERTY_NAME_USER_URL));
-		if (uid && !avatar) {
-			microfeed_subscriber_store_data(subscriber, publisher, uid, image_stored, widget);
-		}
-		if (existing_item) {
-			mauku_scrolling_box_add_before(MAUKU_SCROLLING_BOX(view->container), widget, GTK_WIDGET(existing_item));
+		entry = g_new(Entry, 1);
+		entry->record = record;
+		entry->item = MAUKU_ITEM(widget);
+		entry->iter = insert_entry(view, entry);
+		entry->flags = 0;
+		entry->fingerprint = (normalized ? g_str_hash(normalized) : 0);
+		entry->normalized = normalized;
+		normalized = NULL;
+		entry->copies = NULL;
+		entry->bytes = 0;
+		account_entry(view, entry);
+		if (entry->fingerprint) {
+			g_hash_table_insert(view->fingerprints, GUINT_TO_POINTER(entry->fingerprint),
+			                    g_slist_prepend((GSList*)g_hash_table_lookup(view->fingerprints, GUINT_TO_POINTER(entry->fingerprint)), entry));
+		}
+		g_hash_table_replace(view->items, record, entry);
+		if (!g_hash_table_lookup(view->searchable, record)) {
+			index_record(view, record);
+		}
+		g_signal_connect(widget, "destroy", G_CALLBACK(on_item_destroy), view);
+		g_signal_connect(widget, "memory-usage-changed", G_CALLBACK(on_item_memory_usage_changed), view);
+		if (!g_sequence_iter_is_end((next = g_sequence_iter_next(entry->iter)))) {
+			mauku_scrolling_box_add_before(MAUKU_SCROLLING_BOX(view->container), widget, GTK_WIDGET(((Entry*)g_sequence_get(next))->item));
 		} else {
 			mauku_scrolling_box_add_after(MAUKU_SCROLLING_BOX(view->container), widget, NULL);
 		}
-		gtk_widget_show_all(widget);
+		update_flags(view, entry);
+		if (view->collapse_conversations && (conversation = get_conversation(view, record, TRUE)) && !conversation->expanded) {
+			conversation->row = entry;
+			update_annotation(view, entry);
+		}
 		g_signal_connect(widget, "button-press-event", G_CALLBACK(on_button_press_event), view);
 		g_signal_connect(widget, "button-release-event", G_CALLBACK(on_button_release_event), view);
+		schedule_cache_save(view, record, FALSE);
+		schedule_retention(view, RETENTION_DELAY);
 	}
+	g_free(normalized);
 }
 
-static void item_status_changed(MicrofeedSubscriber* subscriber, const char* publisher, const char* uri, const char* uid, MicrofeedItemStatus status, void* user_data) {
+/* The record in the store and the one shown, if it was seeded from another feed, are brought up to date;
+   their widgets redo only what the changes require. */
+static void item_changed(MicrofeedSubscriber* subscriber, const char* publisher, const char* uri, MicrofeedItem* item, void* user_data) {
 	Subscription* subscription;
 	MaukuView* view;
-	MaukuItem* item;
-	
-	printf("MaukuView::item_status_changed: %s %s %s\n", publisher, uri, uid);
-	
+	MaukuFeedRecord* record;
+	Entry* entry;
+
+	printf("MaukuView::item_changed: %s %s %s\n", publisher, uri, microfeed_item_get_uid(item));
+
 	subscription = (Subscription*)user_data;
 	view = subscription->view;
+	if ((record = mauku_feed_store_lookup(publisher, uri, microfeed_item_get_uid(item)))) {
+		mauku_feed_store_update_record(record, item);
+	}
+	if (!strcmp(microfeed_item_get_uid(item), MICROFEED_ITEM_UID_FEED_METADATA)) {
 
-	if (get_item(view, publisher, uri, uid, 0, &item)) {
-		mauku_item_set_marked(item, status & MICROFEED_ITEM_STATUS_MARKED);
-		mauku_item_set_unread(item, status & MICROFEED_ITEM_STATUS_UNREAD);
+	} else if ((entry = get_entry(view, publisher, microfeed_item_get_uid(item)))) {
+		if (entry->record != record) {
+			mauku_feed_store_update_record(entry->record, item);
+		}
+		/* Another view may have updated the shared record already, so the view state is refreshed regardless. */
+		index_record(view, entry->record);
+		update_flags(view, entry);
+		account_entry(view, entry);
+		schedule_cache_save(view, entry->record, FALSE);
+	} else {
+		item_added(subscriber, publisher, uri, item, user_data);
 	}
 }
 
-static gboolean get_item(MaukuView* view, const gchar* publisher, const gchar* uri, const gchar* uid, time_t timestamp, MaukuItem** item_return) {
-	gboolean found = FALSE;
-	MaukuItem* item;
-	GList* list;
-	GList* child;
-	
-	*item_return = NULL;
-	list = gtk_container_get_children(GTK_CONTAINER(view->container));
-	for (child = list; child; child = child->next) {
-		item = MAUKU_ITEM(child->data);
-		if (timestamp && mauku_item_get_timestamp(item) < timestamp) {
-			*item_return = item;
-			break;		
-		} else if ((!timestamp || mauku_item_get_timestamp(item) == timestamp) &&
-		           !strcmp(mauku_item_get_uid(item), uid) &&
-		           !strcmp(mauku_item_get_uri(item), uri) &&
-		           !strcmp(mauku_item_get_publisher(item), publisher)) {
-			*item_return = item;
-			found = TRUE;
-			break;
+/* Destroying the widget removes the entry from the index, the order and the scrolling box without any walk. */
+static void item_removed(MicrofeedSubscriber* subscriber, const char* publisher, const char* uri, const char* uid, void* user_data) {
+	Subscription* subscription;
+	MaukuFeedRecord* record;
+	Entry* entry;
+	Conversation* conversation;
+	MaukuFeedRecord key;
+	Entry* row;
+
+	printf("MaukuView::item_removed: %s %s %s\n", publisher, uri, uid);
+
+	subscription = (Subscription*)user_data;
+	key.publisher = mauku_intern_lookup(publisher);
+	key.uid = uid;
+	if ((entry = get_entry(subscription->view, publisher, uid))) {
+		remove_entry(subscription->view, entry);
+	} else if (key.publisher && (conversation = (Conversation*)g_hash_table_lookup(subscription->view->collapsed, &key))) {
+		g_hash_table_lookup_extended(subscription->view->collapsed, &key, (gpointer*)&record, NULL);
+		remove_collapsed(subscription->view, record, conversation);
+	} else if (key.publisher && (row = (Entry*)g_hash_table_lookup(subscription->view->folded, &key))) {
+		g_hash_table_lookup_extended(subscription->view->folded, &key, (gpointer*)&record, NULL);
+		remove_folded(subscription->view, record, row);
+	} else if ((record = mauku_feed_store_lookup(publisher, uri, uid))) {
+		remove_queued_record(subscription->view, subscription->view->urgent_queue, record);
+		remove_queued_record(subscription->view, subscription->view->background_queue, record);
+		remove_queued_record(subscription->view, subscription->view->deferred_queue, record);
+	}
+}
+
+static void remove_entry(MaukuView* view, Entry* entry) {
+	Conversation* conversation;
+
+	if ((conversation = get_conversation(view, entry->record, FALSE)) && conversation->row == entry) {
+		/* The other replies form the conversation again without this one. */
+		expand_conversation(view, conversation);
+	}
+	release_copies(view, entry, TRUE);
+	gtk_widget_destroy(GTK_WIDGET(entry->item));
+}
+
+/* The record is the one stored in the collapsed table. */
+static void remove_collapsed(MaukuView* view, MaukuFeedRecord* record, Conversation* conversation) {
+	g_hash_table_remove(view->collapsed, record);
+	g_ptr_array_remove(conversation->members, record);
+	unindex_record(view, record);
+	mauku_feed_record_unref(record);
+	if (conversation->row) {
+		update_annotation(view, conversation->row);
+	}
+}
+
+/* The record is the one stored in the folded table. */
+static void remove_folded(MaukuView* view, MaukuFeedRecord* record, Entry* row) {
+	g_hash_table_remove(view->folded, record);
+	g_ptr_array_remove(row->copies, record);
+	unindex_record(view, record);
+	mauku_feed_record_unref(record);
+	update_annotation(view, row);
+}
+
+static void item_status_changed(MicrofeedSubscriber* subscriber, const char* publisher, const char* uri, const char* uid, MicrofeedItemStatus status, void* user_data) {
+	Subscription* subscription;
+	Entry* entry;
+	gboolean marked;
+	MaukuFeedRecord key;
+	MaukuFeedRecord* record;
+
+	printf("MaukuView::item_status_changed: %s %s %s\n", publisher, uri, uid);
+	
+	subscription = (Subscription*)user_data;
+	key.publisher = mauku_intern_lookup(publisher);
+	key.uid = uid;
+	entry = get_entry(subscription->view, publisher, uid);
+	marked = (entry && entry->record->marked);
+	mauku_feed_store_set_status(publisher, uri, uid, status);
+	if (entry) {
+		mauku_feed_record_set_status(entry->record, status & MICROFEED_ITEM_STATUS_MARKED, status & MICROFEED_ITEM_STATUS_UNREAD);
+		update_flags(subscription->view, entry);
+		/* A read status in the cache is corrected by the publisher when the feed is republished,
+		   so reading items does not rewrite the cache. */
+		if ((status & MICROFEED_ITEM_STATUS_MARKED ? TRUE : FALSE) != marked) {
+			schedule_cache_save(subscription->view, entry->record, FALSE);
 		}
+	} else if (key.publisher && (g_hash_table_lookup_extended(subscription->view->collapsed, &key, (gpointer*)&record, NULL) ||
+	                             g_hash_table_lookup_extended(subscription->view->folded, &key, (gpointer*)&record, NULL))) {
+		/* The record may have been seeded from another feed, so the store update does not reach it. */
+		mauku_feed_record_set_status(record, status & MICROFEED_ITEM_STATUS_MARKED, status & MICROFEED_ITEM_STATUS_UNREAD);
+	}
+}
+
+static Entry* get_entry(MaukuView* view, const gchar* publisher, const gchar* uid) {
+	MaukuFeedRecord key;
+	Entry* entry = NULL;
+	
+	if ((key.publisher = mauku_intern_lookup(publisher))) {
+		key.uid = uid;
+		entry = (Entry*)g_hash_table_lookup(view->items, &key);
 	}
-	g_list_free(list);
+
+	return entry;
+}
+
+static MaukuItem* get_item(MaukuView* view, const gchar* publisher, const gchar* uid) {
+	Entry* entry;
 	
-	return found;
+	entry = get_entry(view, publisher, uid);
+
+	return (entry ? entry->item : NULL);
 }
 
-static void set_progress_indicator(MaukuView* view) {
-	hildon_gtk_window_set_progress_indicator(GTK_WINDOW(view->window), (view->updating || view->republishing ? TRUE : FALSE));
+/* Entries are keyed by the publisher and uid of the record, so that an item seeded from another feed
+   (for example, from the overview into a sender view) is not shown twice. */
+static guint entry_hash(gconstpointer key) {
+	const MaukuFeedRecord* record;
+
+	record = (const MaukuFeedRecord*)key;
+
+	return g_str_hash(record->uid) * 31 + g_direct_hash(record->publisher);
 }
 
-static void mark_all_read(MaukuView* view) {
-	GList* list;
-	GList* child;
-	MaukuItem* item;
+static gboolean entry_equal(gconstpointer a, gconstpointer b) {
 
-	list = gtk_container_get_children(GTK_CONTAINER(view->container));
-	for (child = list; child; child = child->next) {
-		item = MAUKU_ITEM(child->data);
-		if (mauku_item_get_unread(item)) {
-			microfeed_subscriber_read_item(subscriber, mauku_item_get_publisher(item), mauku_item_get_uri(item), mauku_item_get_uid(item), NULL, NULL);
+	return ((const MaukuFeedRecord*)a)->publisher == ((const MaukuFeedRecord*)b)->publisher &&
+	       !strcmp(((const MaukuFeedRecord*)a)->uid, ((const MaukuFeedRecord*)b)->uid);
+}
+
+/* Newest first; ties are ordered by publisher and uid to keep the order stable. */
+static gint compare_entries(gconstpointer a, gconstpointer b, gpointer user_data) {
+
+	return compare_records(((const Entry*)a)->record, ((const Entry*)b)->record);
+}
+
+static gint compare_records(const MaukuFeedRecord* record_a, const MaukuFeedRecord* record_b) {
+	gint retvalue;
+	
+	if (record_a->timestamp != record_b->timestamp) {
+		retvalue = (record_a->timestamp > record_b->timestamp ? -1 : 1);
+	} else if (!(retvalue = strcmp(record_a->publisher, record_b->publisher))) {
+		retvalue = strcmp(record_a->uid, record_b->uid);
+	}
+
+	return retvalue;
+}
+
+static gint compare_batch_records(gconstpointer a, gconstpointer b) {
+
+	return compare_records(*(const MaukuFeedRecord**)a, *(const MaukuFeedRecord**)b);
+}
+
+/* Merged batches are ingested in timeline order, so the position of an entry is first looked for by
+   walking on from the previous insertion. Anything else falls back to a binary search. */
+static GSequenceIter* insert_entry(MaukuView* view, Entry* entry) {
+	GSequenceIter* iter = NULL;
+	guint steps = 0;
+
+	if (view->last_inserted && compare_entries(g_sequence_get(view->last_inserted), entry, NULL) < 0) {
+		iter = g_sequence_iter_next(view->last_inserted);
+		while (iter && !g_sequence_iter_is_end(iter) && compare_entries(g_sequence_get(iter), entry, NULL) < 0) {
+			iter = (++steps < MERGE_WALK_LIMIT ? g_sequence_iter_next(iter) : NULL);
+		}
+	}
+	view->last_inserted = (iter ? g_sequence_insert_before(iter, entry) : g_sequence_insert_sorted(view->order, entry, compare_entries, NULL));
+
+	return view->last_inserted;
+}
+
+/* Merges the completed republish batches of the subscriptions (one per publisher in the overview)
+   into one run in timeline order and queues it for ingestion. The batch with the newest head is kept
+   at the top of a binary heap. The whole run goes to one queue, so that ingest() inserts it in order,
+   each entry next to the previous one. */
+static void merge_batches(MaukuView* view) {
+	GPtrArray* batches;
+	guint* positions;
+	guint* heap;
+	guint n_heap = 0;
+	GList* list;
+	Subscription* subscription;
+	GPtrArray* batch;
+	GQueue* queue = NULL;
+	guint i;
+
+	if (view->merge_id) {
+		g_source_remove(view->merge_id);
+		view->merge_id = 0;
+	}
+	batches = g_ptr_array_new();
+	for (list = view->subscriptions; list; list = list->next) {
+		subscription = (Subscription*)list->data;
+		if (!subscription->republishing && subscription->batch->len > 0) {
+			g_ptr_array_sort(subscription->batch, compare_batch_records);
+			g_ptr_array_add(batches, subscription->batch);
+			subscription->batch = g_ptr_array_new();
+		}
+	}
+	positions = g_new0(guint, batches->len);
+	heap = g_new(guint, batches->len);
+	for (i = 0; i < batches->len; i++) {
+		heap[n_heap++] = i;
+	}
+	for (i = n_heap / 2; i > 0; i--) {
+		sift_down(batches, positions, heap, n_heap, i - 1);
+	}
+	while (n_heap > 0) {
+		batch = (GPtrArray*)batches->pdata[heap[0]];
+		if (!queue) {
+			queue = (is_in_viewport(view, (MaukuFeedRecord*)batch->pdata[0], FALSE) ? view->urgent_queue : view->background_queue);
+		}
+		queue_record_to(view, (MaukuFeedRecord*)batch->pdata[positions[heap[0]]++], queue);
+		if (positions[heap[0]] == batch->len) {
+			heap[0] = heap[--n_heap];
+		}
+		sift_down(batches, positions, heap, n_heap, 0);
+	}
+	g_free(heap);
+	g_free(positions);
+	for (i = 0; i < batches->len; i++) {
+		g_ptr_array_free((GPtrArray*)batches->pdata[i], TRUE);
+	}
+	g_ptr_array_free(batches, TRUE);
+}
+
+/* The batches in the heap are never empty. */
+static void sift_down(GPtrArray* batches, guint* positions, guint* heap, guint n_heap, guint i) {
+	guint child;
+	guint swap;
+
+	while ((child = 2 * i + 1) < n_heap) {
+		if (child + 1 < n_heap &&
+		    compare_records(((GPtrArray*)batches->pdata[heap[child + 1]])->pdata[positions[heap[child + 1]]],
+		                    ((GPtrArray*)batches->pdata[heap[child]])->pdata[positions[heap[child]]]) < 0) {
+			child++;
+		}
+		if (compare_records(((GPtrArray*)batches->pdata[heap[child]])->pdata[positions[heap[child]]],
+		                    ((GPtrArray*)batches->pdata[heap[i]])->pdata[positions[heap[i]]]) < 0) {
+			swap = heap[i];
+			heap[i] = heap[child];
+			heap[child] = swap;
+			i = child;
+		} else {
+			i = n_heap;
+		}
+	}
+}
+
+static gboolean merge_batches_timeout(gpointer user_data) {
+	MaukuView* view;
+
+	view = (MaukuView*)user_data;
+	view->merge_id = 0;
+	merge_batches(view);
+
+	return FALSE;
+}
+
+static void clear_batch(Subscription* subscription) {
+	guint i;
+
+	for (i = 0; i < subscription->batch->len; i++) {
+		mauku_feed_record_unref((MaukuFeedRecord*)subscription->batch->pdata[i]);
+	}
+	g_ptr_array_set_size(subscription->batch, 0);
+}
+
+static void on_item_destroy(GtkWidget* widget, gpointer user_data) {
+	MaukuView* view;
+	MaukuFeedRecord* record;
+	Entry* entry;
+	Conversation* conversation;
+	GSList* list;
+
+	view = (MaukuView*)user_data;
+	record = mauku_item_get_record(MAUKU_ITEM(widget));
+	if ((entry = (Entry*)g_hash_table_lookup(view->items, record)) && GTK_WIDGET(entry->item) == widget) {
+		/* The collapsed replies go with their row. */
+		if ((conversation = get_conversation(view, record, FALSE)) && conversation->row == entry) {
+			free_conversation(view, conversation);
+		}
+		release_copies(view, entry, FALSE);
+		if (entry->fingerprint) {
+			if ((list = g_slist_remove((GSList*)g_hash_table_lookup(view->fingerprints, GUINT_TO_POINTER(entry->fingerprint)), entry))) {
+				g_hash_table_insert(view->fingerprints, GUINT_TO_POINTER(entry->fingerprint), list);
+			} else {
+				g_hash_table_remove(view->fingerprints, GUINT_TO_POINTER(entry->fingerprint));
+			}
+		}
+		g_free(entry->normalized);
+		if (view->last_inserted == entry->iter) {
+			view->last_inserted = NULL;
+		}
+		g_sequence_remove(entry->iter);
+		view->memory_usage -= MIN(view->memory_usage, entry->bytes);
+		g_hash_table_remove(view->unread, record);
+		g_hash_table_remove(view->items, record);
+		unindex_record(view, record);
+		if (g_hash_table_remove(view->prefetching, record)) {
+			cancel_prefetch(record, record, NULL);
+		}
+		schedule_cache_save(view, record, TRUE);
+		mauku_feed_record_unref(record);
+	}
+}
+
+static void set_progress_indicator(MaukuView* view) {
+	hildon_gtk_window_set_progress_indicator(GTK_WINDOW(view->window), (view->updating || view->republishing ? TRUE : FALSE));
+}
+
+/* Sends the read requests for the items in the unread set and for the unread replies and copies folded under
+   a row. The set itself is updated when the publisher reports the status changes. */
+static void mark_all_read(MaukuView* view) {
+	GHashTableIter iter;
+	MaukuFeedRecord* record;
+
+	g_hash_table_iter_init(&iter, view->unread);
+	while (g_hash_table_iter_next(&iter, (gpointer*)&record, NULL)) {
+		read_record(record);
+	}
+	g_hash_table_iter_init(&iter, view->collapsed);
+	while (g_hash_table_iter_next(&iter, (gpointer*)&record, NULL)) {
+		if (record->unread) {
+			read_record(record);
+		}
+	}
+	g_hash_table_iter_init(&iter, view->folded);
+	while (g_hash_table_iter_next(&iter, (gpointer*)&record, NULL)) {
+		if (record->unread) {
+			read_record(record);
+		}
+	}
+}
+
+/* The subscriber API has no call for several items, so each item is read separately. The status changes
+   come back later through item_status_changed(), so the tables are not changed while they are walked. */
+static void read_record(MaukuFeedRecord* record) {
+	microfeed_subscriber_read_item(subscriber, record->publisher, record->uri, record->uid, NULL, NULL);
+}
+
+/* The record is remembered as changed or removed until the save. */
+static void schedule_cache_save(MaukuView* view, MaukuFeedRecord* record, gboolean removed) {
+	if (view->cached) {
+		g_hash_table_replace(view->cache_changes, mauku_feed_record_ref(record), GINT_TO_POINTER(removed));
+		if (!view->cache_save_id) {
+			view->cache_save_id = g_timeout_add_seconds(CACHE_SAVE_DELAY, save_cache, view);
+		}
+	}
+}
+
+/* Only the changes are appended to the cache. The cache asks for all the items when it needs compacting. */
+static gboolean save_cache(gpointer user_data) {
+	MaukuView* view;
+	GPtrArray* records;
+	GPtrArray* removed;
+	GHashTableIter hash_iter;
+	MaukuFeedRecord* record;
+	gpointer value;
+	GSequenceIter* iter;
+
+	view = (MaukuView*)user_data;
+	view->cache_save_id = 0;
+	records = g_ptr_array_new();
+	removed = g_ptr_array_new();
+	g_hash_table_iter_init(&hash_iter, view->cache_changes);
+	while (g_hash_table_iter_next(&hash_iter, (gpointer*)&record, &value)) {
+		g_ptr_array_add((GPOINTER_TO_INT(value) ? removed : records), record);
+	}
+	if (!mauku_cache_append((MaukuFeedRecord**)records->pdata, records->len, (MaukuFeedRecord**)removed->pdata, removed->len)) {
+		g_ptr_array_set_size(records, 0);
+		for (iter = g_sequence_get_begin_iter(view->order); !g_sequence_iter_is_end(iter); iter = g_sequence_iter_next(iter)) {
+			g_ptr_array_add(records, ((Entry*)g_sequence_get(iter))->record);
+		}
+		mauku_cache_write((MaukuFeedRecord**)records->pdata, records->len);
+	}
+	g_ptr_array_free(records, TRUE);
+	g_ptr_array_free(removed, TRUE);
+	g_hash_table_remove_all(view->cache_changes);
+
+	return FALSE;
+}
+
+/* Takes over the reference to the record. The widget is created later by ingest(). While the window is hidden,
+   a record older than the retention age is dropped at once, and the queues are trimmed to the queue limit
+   whenever they grow to twice of it. */
+static void queue_record(MaukuView* view, MaukuFeedRecord* record) {
+	queue_record_to(view, record, (is_in_viewport(view, record, FALSE) ? view->urgent_queue : view->background_queue));
+}
+
+/* As above, but to the given queue. */
+static void queue_record_to(MaukuView* view, MaukuFeedRecord* record, GQueue* queue) {
+	Pending* pending;
+
+	if (!GTK_WIDGET_VISIBLE(view->window) && view->retention.max_age && record->timestamp < time(NULL) - view->retention.max_age) {
+		mauku_feed_record_unref(record);
+	} else {
+		index_record(view, record);
+		pending = g_slice_new(Pending);
+		pending->record = record;
+		g_get_current_time(&pending->queued);
+		g_queue_push_tail(queue, pending);
+		view->ingest_counters.queue_depth++;
+		if (view->ingest_counters.queue_depth > view->ingest_counters.max_queue_depth) {
+			view->ingest_counters.max_queue_depth = view->ingest_counters.queue_depth;
+		}
+		if (GTK_WIDGET_VISIBLE(view->window)) {
+			if (!view->ingest_id) {
+				view->ingest_id = g_idle_add(ingest, view);
+			}
+		} else if (view->ingest_counters.queue_depth > 2 * get_queue_limit(view)) {
+			trim_queues(view);
+		}
+	}
+}
+
+/* Creates widgets for queued records until the time budget of one main loop iteration is spent. The deferred
+   records are counted in the queue depth, but they wait for release_deferred(). */
+static gboolean ingest(gpointer user_data) {
+	MaukuView* view;
+	GTimeVal started;
+	Pending* pending;
+	guint latency;
+	gboolean retvalue;
+
+	view = (MaukuView*)user_data;
+	g_get_current_time(&started);
+	while ((view->urgent_queue->length > 0 || view->background_queue->length > 0) && GTK_WIDGET_VISIBLE(view->window) &&
+	       get_elapsed_milliseconds(&started) < INGEST_BUDGET_MILLISECONDS) {
+		if (!(pending = (Pending*)g_queue_pop_head(view->urgent_queue))) {
+			pending = (Pending*)g_queue_pop_head(view->background_queue);
+		}
+		latency = get_elapsed_milliseconds(&pending->queued);
+		view->ingest_counters.last_latency = latency;
+		if (latency > view->ingest_counters.max_latency) {
+			view->ingest_counters.max_latency = latency;
+		}
+		view->ingest_counters.queue_depth--;
+		view->ingest_counters.ingested++;
+		add_entry(view, pending->record);
+		g_slice_free(Pending, pending);
+	}
+
+	if ((view->urgent_queue->length > 0 || view->background_queue->length > 0) && GTK_WIDGET_VISIBLE(view->window)) {
+		retvalue = TRUE;
+	} else if (view->urgent_queue->length > 0 || view->background_queue->length > 0) {
+		printf("MaukuView::ingest: window hidden, %u records wait for widgets\n", view->ingest_counters.queue_depth);
+		view->ingest_id = 0;
+		retvalue = FALSE;
+	} else {
+		printf("MaukuView::ingest: %u items, queue depth at most %u, latency at most %u ms, %u records deferred\n",
+		       view->ingest_counters.ingested, view->ingest_counters.max_queue_depth, view->ingest_counters.max_latency,
+		       view->deferred_queue->length);
+		view->ingest_id = 0;
+		schedule_prefetch(view);
+		retvalue = FALSE;
+	}
+
+	return retvalue;
+}
+
+/* Drops the queued records of the given feed, or all of them if the publisher is NULL. */
+static void clear_queue(MaukuView* view, GQueue* queue, const gchar* publisher, const gchar* uri) {
+	GList* list;
+	GList* next;
+	Pending* pending;
+
+	for (list = queue->head; list; list = next) {
+		next = list->next;
+		pending = (Pending*)list->data;
+		if (!publisher || (pending->record->publisher == publisher && pending->record->uri == uri)) {
+			g_queue_delete_link(queue, list);
+			view->ingest_counters.queue_depth--;
+			unindex_record(view, pending->record);
+			mauku_feed_record_unref(pending->record);
+			g_slice_free(Pending, pending);
+		}
+	}
+}
+
+/* The queue is short unless a burst is being ingested, and removals are rare. */
+static void remove_queued_record(MaukuView* view, GQueue* queue, MaukuFeedRecord* record) {
+	GList* list;
+	GList* next;
+	Pending* pending;
+
+	for (list = queue->head; list; list = next) {
+		next = list->next;
+		pending = (Pending*)list->data;
+		if (pending->record == record) {
+			g_queue_delete_link(queue, list);
+			view->ingest_counters.queue_depth--;
+			unindex_record(view, pending->record);
+			mauku_feed_record_unref(pending->record);
+			g_slice_free(Pending, pending);
+		}
+	}
+}
+
+/* Whether the record would be inserted inside the visible part of the view, or within one screen of it with the
+   margin. Before the neighbouring item has been allocated, the first screenful of positions (or two) counts as visible. */
+static gboolean is_in_viewport(MaukuView* view, MaukuFeedRecord* record, gboolean with_margin) {
+	Entry probe;
+	GSequenceIter* iter;
+	GtkAdjustment* adjustment;
+	GtkWidget* widget;
+	gint y;
+	gint margin;
+	gboolean retvalue;
+
+	probe.record = record;
+	iter = g_sequence_search(view->order, &probe, compare_entries, NULL);
+	if (g_sequence_iter_is_begin(iter) && g_sequence_iter_is_end(iter)) {
+		retvalue = TRUE;
+	} else {
+		if (g_sequence_iter_is_end(iter)) {
+			widget = GTK_WIDGET(((Entry*)g_sequence_get(g_sequence_iter_prev(iter)))->item);
+			y = widget->allocation.y + widget->allocation.height;
+		} else {
+			widget = GTK_WIDGET(((Entry*)g_sequence_get(iter))->item);
+			y = widget->allocation.y;
+		}
+		if (widget->allocation.y < 0) {
+			retvalue = (g_sequence_iter_get_position(iter) < (with_margin ? 2 : 1) * get_first_screen_count(view));
+		} else {
+			adjustment = hildon_pannable_area_get_vadjustment(HILDON_PANNABLE_AREA(view->pannable_area));
+			margin = (with_margin ? adjustment->page_size : 0);
+			retvalue = (y >= adjustment->value - margin && y <= adjustment->value + adjustment->page_size + margin);
+		}
+	}
+
+	return retvalue;
+}
+
+/* Moves all queued records to the deferred queue, newest first, dropping the ones over the retention age
+   and the queue limit. */
+static void trim_queues(MaukuView* view) {
+	GPtrArray* pendings;
+	Pending* pending;
+	time_t oldest;
+	guint limit;
+	guint i;
+
+	pendings = g_ptr_array_sized_new(view->ingest_counters.queue_depth);
+	while ((pending = (Pending*)g_queue_pop_head(view->urgent_queue))) {
+		g_ptr_array_add(pendings, pending);
+	}
+	while ((pending = (Pending*)g_queue_pop_head(view->background_queue))) {
+		g_ptr_array_add(pendings, pending);
+	}
+	while ((pending = (Pending*)g_queue_pop_head(view->deferred_queue))) {
+		g_ptr_array_add(pendings, pending);
+	}
+	g_ptr_array_sort(pendings, compare_pending);
+	oldest = (view->retention.max_age ? time(NULL) - view->retention.max_age : 0);
+	limit = get_queue_limit(view);
+	for (i = 0; i < pendings->len; i++) {
+		pending = (Pending*)pendings->pdata[i];
+		if (i >= limit || pending->record->timestamp < oldest) {
+			view->ingest_counters.queue_depth--;
+			unindex_record(view, pending->record);
+			mauku_feed_record_unref(pending->record);
+			g_slice_free(Pending, pending);
+		} else {
+			g_queue_push_tail(view->deferred_queue, pending);
+		}
+	}
+	printf("MaukuView::trim_queues: %u records kept of %u\n", view->deferred_queue->length, pendings->len);
+	g_ptr_array_free(pendings, TRUE);
+}
+
+/* The retention limit, or a default one without it, so that a hidden view does not hold an unbounded backlog. */
+static guint get_queue_limit(MaukuView* view) {
+
+	return (view->retention.max_items ? view->retention.max_items : HIDDEN_QUEUE_MAX_ITEMS);
+}
+
+static gint compare_pending(gconstpointer a, gconstpointer b) {
+
+	return compare_records((*(Pending**)a)->record, (*(Pending**)b)->record);
+}
+
+/* Queues the deferred records that would be inserted within one screen of the viewport for ingest(). The rest stay
+   as data. At most two screenfuls are released at a time, since nothing is allocated in an empty view to compare with;
+   the next call after they are ingested and laid out releases more if they are still near. */
+static void release_deferred(MaukuView* view) {
+	GList* list;
+	GList* next;
+	Pending* pending;
+	guint limit;
+	guint released = 0;
+
+	limit = 2 * get_first_screen_count(view);
+	for (list = view->deferred_queue->head; list && released < limit; list = next) {
+		next = list->next;
+		pending = (Pending*)list->data;
+		if (is_in_viewport(view, pending->record, TRUE)) {
+			g_queue_delete_link(view->deferred_queue, list);
+			g_queue_push_tail((is_in_viewport(view, pending->record, FALSE) ? view->urgent_queue : view->background_queue), pending);
+			released++;
+		}
+	}
+	if (released > 0 && !view->ingest_id) {
+		view->ingest_id = g_idle_add(ingest, view);
+	}
+}
+
+static void schedule_prefetch(MaukuView* view) {
+	if (!view->prefetch_id) {
+		view->prefetch_id = g_timeout_add_full(G_PRIORITY_LOW, PREFETCH_DELAY, update_prefetch, view, NULL);
+	}
+}
+
+/* Requests the comment feeds of the items in the viewport and cancels the requests for items that are not there anymore. */
+static gboolean update_prefetch(gpointer user_data) {
+	MaukuView* view;
+	GtkAdjustment* adjustment;
+	GHashTable* prefetching;
+	GSequenceIter* iter;
+	MaukuFeedRecord* record;
+	GtkWidget* widget;
+	GHashTableIter hash_iter;
+
+	view = (MaukuView*)user_data;
+	view->prefetch_id = 0;
+	/* The scroll has stopped, so the deferred records that came near are given widgets too. */
+	if (GTK_WIDGET_VISIBLE(view->window) && view->deferred_queue->length > 0) {
+		release_deferred(view);
+	}
+	adjustment = hildon_pannable_area_get_vadjustment(HILDON_PANNABLE_AREA(view->pannable_area));
+	prefetching = g_hash_table_new(g_direct_hash, g_direct_equal);
+	for (iter = get_viewport_begin(view);
+	     GTK_WIDGET_VISIBLE(view->window) && !g_sequence_iter_is_end(iter);
+	     iter = g_sequence_iter_next(iter)) {
+		record = ((Entry*)g_sequence_get(iter))->record;
+		widget = GTK_WIDGET(((Entry*)g_sequence_get(iter))->item);
+		if (GTK_WIDGET_VISIBLE(widget) && widget->allocation.y >= 0) {
+			if (widget->allocation.y > adjustment->value + adjustment->page_size) {
+				break;
+			}
+			if (widget->allocation.y + widget->allocation.height >= adjustment->value && record->comments && record->comments_uri) {
+				g_hash_table_insert(prefetching, record, record);
+				mauku_prefetch_request(record->publisher, record->comments_uri);
+			}
+		}
+	}
+	g_hash_table_iter_init(&hash_iter, view->prefetching);
+	while (g_hash_table_iter_next(&hash_iter, (gpointer*)&record, NULL)) {
+		if (!g_hash_table_lookup(prefetching, record)) {
+			cancel_prefetch(record, record, NULL);
+		}
+	}
+	g_hash_table_destroy(view->prefetching);
+	view->prefetching = prefetching;
+
+	return FALSE;
+}
+
+/* A binary search by position for the first entry that reaches the top of the viewport. A hidden or not yet
+   allocated entry is judged by the next entry that is laid out. */
+static GSequenceIter* get_viewport_begin(MaukuView* view) {
+	GtkAdjustment* adjustment;
+	GSequenceIter* iter;
+	GtkWidget* widget;
+	gint low;
+	gint high;
+	gint middle;
+
+	adjustment = hildon_pannable_area_get_vadjustment(HILDON_PANNABLE_AREA(view->pannable_area));
+	low = 0;
+	high = g_sequence_get_length(view->order);
+	while (low < high) {
+		middle = (low + high) / 2;
+		for (iter = g_sequence_get_iter_at_pos(view->order, middle); !g_sequence_iter_is_end(iter); iter = g_sequence_iter_next(iter)) {
+			widget = GTK_WIDGET(((Entry*)g_sequence_get(iter))->item);
+			if (GTK_WIDGET_VISIBLE(widget) && widget->allocation.y >= 0) {
+				break;
+			}
+		}
+		if (g_sequence_iter_is_end(iter) || widget->allocation.y + widget->allocation.height >= adjustment->value) {
+			high = middle;
+		} else {
+			low = g_sequence_iter_get_position(iter) + 1;
+		}
+	}
+
+	return g_sequence_get_iter_at_pos(view->order, low);
+}
+
+static void cancel_prefetch(gpointer key, gpointer value, gpointer user_data) {
+	MaukuFeedRecord* record;
+
+	record = (MaukuFeedRecord*)key;
+	mauku_prefetch_cancel(record->publisher, record->comments_uri);
+}
+
+static void schedule_retention(MaukuView* view, guint seconds) {
+	if (!view->retention_id && (view->retention.max_items || view->retention.max_age || view->retention.max_bytes)) {
+		view->retention_id = g_timeout_add_seconds(seconds, enforce_retention, view);
+	}
+}
+
+/* Walks from the oldest item towards the newest, evicting until the view is within its limits. The walk stops at
+   the viewport: removing the items above it would move the visible content, since the scrolling box does not
+   adjust the scroll position. */
+static gboolean enforce_retention(gpointer user_data) {
+	MaukuView* view;
+	GSequenceIter* iter;
+	Entry* entry;
+	guint count;
+	time_t oldest;
+	guint evicted = 0;
+
+	view = (MaukuView*)user_data;
+	view->retention_id = 0;
+	count = g_sequence_get_length(view->order);
+	oldest = (view->retention.max_age ? time(NULL) - view->retention.max_age : 0);
+	iter = g_sequence_get_end_iter(view->order);
+	while (!g_sequence_iter_is_begin(iter)) {
+		entry = (Entry*)g_sequence_get(g_sequence_iter_prev(iter));
+		if (((!view->retention.max_items || count <= view->retention.max_items) &&
+		     (!view->retention.max_bytes || view->memory_usage <= view->retention.max_bytes) &&
+		     entry->record->timestamp >= oldest) ||
+		    is_entry_in_viewport(view, entry)) {
+			break;
+		}
+		if (entry->record->marked) {
+			iter = g_sequence_iter_prev(iter);
+		} else {
+			count--;
+			evicted++;
+			/* Removes the entry from the sequence, so iter stays valid. */
+			gtk_widget_destroy(GTK_WIDGET(entry->item));
+		}
+	}
+	printf("MaukuView::enforce_retention: evicted %u items, %u items left, %lu bytes of %lu\n",
+	       evicted, count, (unsigned long)view->memory_usage, (unsigned long)view->retention.max_bytes);
+	if (view->retention.max_age) {
+		schedule_retention(view, RETENTION_AGE_INTERVAL);
+	}
+
+	return FALSE;
+}
+
+/* The record may be shared with other views, but it is counted in full in each of them. */
+static gsize get_entry_memory_usage(Entry* entry) {
+	gsize bytes;
+
+	bytes = sizeof(Entry) + sizeof(MaukuFeedRecord) + entry->record->n_spans * sizeof(MaukuItemSpan) +
+	        mauku_item_get_memory_usage(entry->item);
+	if (entry->record->text) {
+		bytes += strlen(entry->record->text) + 1;
+	}
+	if (entry->record->avatar) {
+		bytes += sizeof(GdkPixbuf*);
+	}
+
+	return bytes;
+}
+
+static void account_entry(MaukuView* view, Entry* entry) {
+	view->memory_usage -= MIN(view->memory_usage, entry->bytes);
+	entry->bytes = get_entry_memory_usage(entry);
+	view->memory_usage += entry->bytes;
+}
+
+/* The item creates its layouts and buffer only when it is laid out and exposed, long after add_entry(). */
+static void on_item_memory_usage_changed(MaukuItem* item, gpointer user_data) {
+	MaukuView* view;
+	Entry* entry;
+
+	view = (MaukuView*)user_data;
+	if ((entry = (Entry*)g_hash_table_lookup(view->items, mauku_item_get_record(item))) && entry->item == item) {
+		account_entry(view, entry);
+	}
+}
+
+/* The scroll anchor: an item that is at least partly visible. */
+static gboolean is_entry_in_viewport(MaukuView* view, Entry* entry) {
+	GtkAdjustment* adjustment;
+	GtkWidget* widget;
+
+	adjustment = hildon_pannable_area_get_vadjustment(HILDON_PANNABLE_AREA(view->pannable_area));
+	widget = GTK_WIDGET(entry->item);
+
+	return (GTK_WIDGET_VISIBLE(widget) && widget->allocation.y >= 0 &&
+	        widget->allocation.y + widget->allocation.height >= adjustment->value &&
+	        widget->allocation.y <= adjustment->value + adjustment->page_size);
+}
+
+/* The records received while the window was hidden are trimmed to the retention limits and sorted again by
+   what is visible now. Widgets are created only for the records within one screen of the viewport. */
+static void on_window_show(MaukuView* view) {
+	if (view->ingest_counters.queue_depth > 0) {
+		trim_queues(view);
+		release_deferred(view);
+	}
+	schedule_prefetch(view);
+}
+
+/* While hidden, the view only accumulates records: ingest() stops creating widgets, and the existing
+   items give up their layouts, buffers and timers. Prefetching is cancelled. */
+static void on_window_hide(MaukuView* view) {
+	GSequenceIter* iter;
+
+	for (iter = g_sequence_get_begin_iter(view->order); !g_sequence_iter_is_end(iter); iter = g_sequence_iter_next(iter)) {
+		mauku_item_release_resources(((Entry*)g_sequence_get(iter))->item);
+	}
+	schedule_prefetch(view);
+}
+
+static Conversation* get_conversation(MaukuView* view, MaukuFeedRecord* record, gboolean create) {
+	Conversation* conversation = NULL;
+	Conversation probe;
+
+	if (record->referred_uid) {
+		probe.publisher = record->publisher;
+		probe.referred_uid = record->referred_uid;
+		if (!(conversation = (Conversation*)g_hash_table_lookup(view->conversations, &probe)) && create) {
+			conversation = g_new0(Conversation, 1);
+			conversation->publisher = record->publisher;
+			conversation->referred_uid = mauku_intern_string(record->referred_uid);
+			conversation->members = g_ptr_array_new();
+			g_hash_table_insert(view->conversations, conversation, conversation);
+		}
+	}
+
+	return conversation;
+}
+
+/* The publisher is interned, as in entry_hash(). */
+static guint conversation_hash(gconstpointer key) {
+	const Conversation* conversation;
+
+	conversation = (const Conversation*)key;
+
+	return g_str_hash(conversation->referred_uid) * 31 + g_direct_hash(conversation->publisher);
+}
+
+static gboolean conversation_equal(gconstpointer a, gconstpointer b) {
+
+	return ((const Conversation*)a)->publisher == ((const Conversation*)b)->publisher &&
+	       !strcmp(((const Conversation*)a)->referred_uid, ((const Conversation*)b)->referred_uid);
+}
+
+/* Takes over the reference to the record if it is older than the row of its conversation and returns TRUE.
+   A newer record replaces the row, and the caller adds it as usual. */
+static gboolean collapse_record(MaukuView* view, MaukuFeedRecord* record) {
+	gboolean retvalue = FALSE;
+	Conversation* conversation;
+	Entry* row;
+
+	if (view->collapse_conversations && (conversation = get_conversation(view, record, FALSE)) && !conversation->expanded && conversation->row) {
+		if (compare_records(record, conversation->row->record) > 0) {
+			g_ptr_array_add(conversation->members, record);
+			g_hash_table_insert(view->collapsed, record, conversation);
+			update_annotation(view, conversation->row);
+			if (view->search_results && matches_search(view, record)) {
+				add_search_result(view, record);
+				apply_filter(view, conversation->row);
+			}
+			retvalue = TRUE;
+		} else {
+			row = conversation->row;
+			conversation->row = NULL;
+			g_ptr_array_add(conversation->members, mauku_feed_record_ref(row->record));
+			/* In the collapsed set before the widget goes, so that the record stays searchable. */
+			g_hash_table_insert(view->collapsed, row->record, conversation);
+			gtk_widget_destroy(GTK_WIDGET(row->item));
+		}
+	}
+
+	return retvalue;
+}
+
+/* The collapsed replies get their widgets through the ingest queue. */
+static void expand_conversation(MaukuView* view, Conversation* conversation) {
+	guint i;
+
+	conversation->expanded = TRUE;
+	for (i = 0; i < conversation->members->len; i++) {
+		g_hash_table_remove(view->collapsed, g_ptr_array_index(conversation->members, i));
+		queue_record(view, (MaukuFeedRecord*)g_ptr_array_index(conversation->members, i));
+	}
+	g_ptr_array_set_size(conversation->members, 0);
+	if (conversation->row) {
+		update_annotation(view, conversation->row);
+	}
+}
+
+static void free_conversation(MaukuView* view, Conversation* conversation) {
+	guint i;
+
+	for (i = 0; i < conversation->members->len; i++) {
+		g_hash_table_remove(view->collapsed, g_ptr_array_index(conversation->members, i));
+		unindex_record(view, (MaukuFeedRecord*)g_ptr_array_index(conversation->members, i));
+		mauku_feed_record_unref((MaukuFeedRecord*)g_ptr_array_index(conversation->members, i));
+	}
+	g_ptr_array_free(conversation->members, TRUE);
+	g_hash_table_remove(view->conversations, conversation);
+	mauku_intern_release(conversation->referred_uid);
+	g_free(conversation);
+}
+
+/* Tells about the replies collapsed into the row and the copies folded into it. */
+static void update_annotation(MaukuView* view, Entry* entry) {
+	GString* string;
+	Conversation* conversation;
+	MaukuFeedRecord* record;
+	gchar* s;
+	guint i;
+
+	string = g_string_new(NULL);
+	if ((conversation = get_conversation(view, entry->record, FALSE)) && conversation->row == entry) {
+		if (conversation->members->len == 1) {
+			g_string_append(string, "1 earlier reply, tap to show");
+		} else if (conversation->members->len > 1) {
+			g_string_append_printf(string, "%u earlier replies, tap to show", conversation->members->len);
+		}
+	}
+	for (i = 0; entry->copies && i < entry->copies->len; i++) {
+		record = (MaukuFeedRecord*)g_ptr_array_index(entry->copies, i);
+		/* The forward may have arrived first and become the row, so the wording follows the flags of both. */
+		if (mauku_search_is_forwarded(record->text)) {
+			s = g_strconcat("forwarded by ", (record->sender ? record->sender : record->publisher_part), NULL);
+		} else if (mauku_search_is_forwarded(entry->record->text)) {
+			s = g_strconcat("original by ", (record->sender ? record->sender : record->publisher_part), NULL);
+		} else {
+			s = g_strconcat("also on ", record->publisher_part, NULL);
+		}
+		if (!strstr(string->str, s)) {
+			if (string->len) {
+				g_string_append(string, "; ");
+			}
+			g_string_append(string, s);
+		}
+		g_free(s);
+	}
+	mauku_item_set_annotation(entry->item, (string->len ? string->str : NULL));
+	g_string_free(string, TRUE);
+}
+
+/* Takes over the reference to the record and returns TRUE if it is a copy of an item shown in the view:
+   the same text on another service, or a forward of it, within COPY_WINDOW. Otherwise, returns the
+   normalized text to index the record with, or NULL. The entries keep their normalized text, so the
+   candidates of a fingerprint are compared without normalizing them again. */
+static gboolean fold_copy(MaukuView* view, MaukuFeedRecord* record, gchar** normalized_return) {
+	gboolean retvalue = FALSE;
+	gchar* normalized = NULL;
+	gboolean forwarded;
+	GSList* list;
+	Entry* entry;
+	Entry* row = NULL;
+
+	if (view->fold_copies && (normalized = mauku_search_normalize_copy(record->text, &forwarded))) {
+		for (list = (GSList*)g_hash_table_lookup(view->fingerprints, GUINT_TO_POINTER(g_str_hash(normalized))); list && !row; list = list->next) {
+			entry = (Entry*)list->data;
+			if (ABS(entry->record->timestamp - record->timestamp) <= COPY_WINDOW && !strcmp(entry->normalized, normalized) &&
+			    (forwarded || entry->record->publisher != record->publisher || mauku_search_is_forwarded(entry->record->text))) {
+				row = entry;
+			}
+		}
+	}
+	if (row) {
+		if (!row->copies) {
+			row->copies = g_ptr_array_new();
+		}
+		g_ptr_array_add(row->copies, record);
+		g_hash_table_insert(view->folded, record, row);
+		update_annotation(view, row);
+		if (view->search_results && matches_search(view, record)) {
+			add_search_result(view, record);
+			apply_filter(view, row);
+		}
+		g_free(normalized);
+		normalized = NULL;
+		retvalue = TRUE;
+	}
+	*normalized_return = normalized;
+
+	return retvalue;
+}
+
+/* The copies of a removed item are shown on their own, and the copies of an evicted one go with it. */
+static void release_copies(MaukuView* view, Entry* entry, gboolean requeue) {
+	guint i;
+
+	if (entry->copies) {
+		for (i = 0; i < entry->copies->len; i++) {
+			g_hash_table_remove(view->folded, g_ptr_array_index(entry->copies, i));
+			if (requeue) {
+				queue_record(view, (MaukuFeedRecord*)g_ptr_array_index(entry->copies, i));
+			} else {
+				unindex_record(view, (MaukuFeedRecord*)g_ptr_array_index(entry->copies, i));
+				mauku_feed_record_unref((MaukuFeedRecord*)g_ptr_array_index(entry->copies, i));
+			}
+		}
+		g_ptr_array_free(entry->copies, TRUE);
+		entry->copies = NULL;
+	}
+}
+
+static glong get_elapsed_milliseconds(GTimeVal* since) {
+	GTimeVal now;
+
+	g_get_current_time(&now);
+
+	return (now.tv_sec - since->tv_sec) * 1000 + (now.tv_usec - since->tv_usec) / 1000;
+}
+
+/* Recomputes the predicate bits of the entry, its membership in the unread set and its visibility under the filter. */
+static void update_flags(MaukuView* view, Entry* entry) {
+	guint flags;
+
+	flags = (entry->record->unread ? MAUKU_VIEW_FILTER_UNREAD : 0) |
+	        (entry->record->marked ? MAUKU_VIEW_FILTER_MARKED : 0) |
+	        (entry->record->comments ? MAUKU_VIEW_FILTER_COMMENTED : 0) |
+	        (entry->record->referred_uri ? MAUKU_VIEW_FILTER_REFERRING : 0);
+	if (flags & MAUKU_VIEW_FILTER_UNREAD) {
+		g_hash_table_insert(view->unread, entry->record, entry);
+	} else {
+		g_hash_table_remove(view->unread, entry->record);
+	}
+	entry->flags = flags;
+	apply_filter(view, entry);
+}
+
+static gboolean is_filtered_in(MaukuView* view, Entry* entry) {
+
+	return ((entry->flags & view->filter) == view->filter &&
+	        (!view->search_results || g_hash_table_lookup(view->search_results, entry->record)));
+}
+
+/* Verifies a match against the folded text kept for the record, since the index may give false candidates. */
+static gboolean matches_search(MaukuView* view, MaukuFeedRecord* record) {
+	const gchar* folded;
+
+	return ((folded = (const gchar*)g_hash_table_lookup(view->searchable, record)) && strstr(folded, view->search_query));
+}
+
+/* Every record the view holds, shown or not, is searchable: the text and the sender are indexed and kept
+   case folded once, and refreshed when the record is indexed again after a change. */
+static void index_record(MaukuView* view, MaukuFeedRecord* record) {
+	MaukuFeedRecord* indexed;
+	gchar* folded;
+	gchar* s;
+
+	if (g_hash_table_lookup_extended(view->searchable, record, (gpointer*)&indexed, (gpointer*)&folded)) {
+		mauku_search_index_remove(view->search_index, indexed);
+		g_free(folded);
+	} else {
+		indexed = mauku_feed_record_ref(record);
+	}
+	s = g_strconcat((indexed->text ? indexed->text : ""), "\n", (indexed->sender ? indexed->sender : ""), NULL);
+	g_hash_table_insert(view->searchable, indexed, mauku_search_normalize(s));
+	g_free(s);
+	mauku_search_index_add(view->search_index, indexed, indexed->text);
+	mauku_search_index_add(view->search_index, indexed, indexed->sender);
+	if (view->search_results) {
+		if (matches_search(view, indexed)) {
+			add_search_result(view, indexed);
+		} else {
+			g_hash_table_remove(view->search_results, indexed);
+		}
+	}
+}
+
+/* Does nothing while the record is still shown, collapsed or folded in the view. */
+static void unindex_record(MaukuView* view, MaukuFeedRecord* record) {
+	MaukuFeedRecord* indexed;
+	gchar* folded;
+
+	if (!g_hash_table_lookup(view->items, record) && !g_hash_table_lookup(view->collapsed, record) &&
+	    !g_hash_table_lookup(view->folded, record) &&
+	    g_hash_table_lookup_extended(view->searchable, record, (gpointer*)&indexed, (gpointer*)&folded)) {
+		g_hash_table_remove(view->searchable, indexed);
+		mauku_search_index_remove(view->search_index, indexed);
+		if (view->search_results) {
+			g_hash_table_remove(view->search_results, indexed);
+		}
+		g_free(folded);
+		mauku_feed_record_unref(indexed);
+	}
+}
+
+/* A matching record that is collapsed or folded brings its row along. */
+static void add_search_result(MaukuView* view, MaukuFeedRecord* record) {
+	Conversation* conversation;
+	Entry* row;
+
+	g_hash_table_insert(view->search_results, record, record);
+	if ((conversation = (Conversation*)g_hash_table_lookup(view->collapsed, record)) && conversation->row) {
+		g_hash_table_insert(view->search_results, conversation->row->record, conversation->row->record);
+	}
+	if ((row = (Entry*)g_hash_table_lookup(view->folded, record))) {
+		g_hash_table_insert(view->search_results, row->record, row->record);
+	}
+}
+
+static void apply_filter(MaukuView* view, Entry* entry) {
+	if (is_filtered_in(view, entry) != (GTK_WIDGET_VISIBLE(entry->item) ? TRUE : FALSE)) {
+		if (is_filtered_in(view, entry)) {
+			gtk_widget_show(GTK_WIDGET(entry->item));
+		} else {
+			gtk_widget_hide(GTK_WIDGET(entry->item));
 		}
 	}
-	g_list_free(list);
 }
 
 
@@ -10,11 +10,46 @@
 
 typedef struct _MaukuView MaukuView;
 
+typedef enum {
+	MAUKU_VIEW_FILTER_UNREAD = 1 << 0,
+	MAUKU_VIEW_FILTER_MARKED = 1 << 1,
+	MAUKU_VIEW_FILTER_COMMENTED = 1 << 2,
+	MAUKU_VIEW_FILTER_REFERRING = 1 << 3
+} MaukuViewFilter;
+
+/* Counters of the queue between the microfeed callbacks and widget creation. Latencies are in milliseconds. */
+typedef struct {
+	guint queue_depth;
+	guint max_queue_depth;
+	guint ingested;
+	guint last_latency;
+	guint max_latency;
+} MaukuViewIngestCounters;
+
+/* Limits of the items kept in a view, zero meaning no limit. The age is in seconds, and the bytes
+   are an estimate of the text, layouts, buffers and avatar references of the items. */
+typedef struct {
+	guint max_items;
+	guint max_age;
+	gsize max_bytes;
+} MaukuViewRetention;
+
 MaukuView* mauku_view_new(const gchar* title, gboolean permanent);
+MaukuView* mauku_view_open(const gchar* title, const gchar* publisher, const gchar* uri);
+void mauku_view_free(MaukuView* view);
 void mauku_view_show(MaukuView* view);
 void mauku_view_add_feed(MaukuView* view, const gchar* publisher, const gchar* uri);
 void mauku_view_remove_feed(MaukuView* view, const gchar* publisher, const gchar* uri);
 gboolean mauku_view_scroll_to_item(MaukuView* view, const gchar* publisher, const gchar* uri, const gchar* uid);
 void mauku_view_update(MaukuView* view);
+void mauku_view_set_compact(MaukuView* view, gboolean compact);
+void mauku_view_set_cached(MaukuView* view, gboolean cached);
+void mauku_view_set_filter(MaukuView* view, guint filter);
+void mauku_view_set_search(MaukuView* view, const gchar* query);
+void mauku_view_set_collapse_conversations(MaukuView* view, gboolean collapse);
+void mauku_view_set_fold_copies(MaukuView* view, gboolean fold);
+const MaukuViewIngestCounters* mauku_view_get_ingest_counters(MaukuView* view);
+void mauku_view_set_retention(MaukuView* view, const MaukuViewRetention* retention);
+gsize mauku_view_get_memory_usage(MaukuView* view);
 
 #endif